@@ -0,0 +1,17 @@
+#the sha256 of every shader source, a "hash  path" line each. the build writes it next to the spir-v whenever it
+#compiles the shaders, so the checked in stamp names the glsl the checked in spir-v was built from
+function(shader_stamp ROOT OUT)
+	set(LINES "")
+	foreach(SOURCE ${ARGN})
+		file(SHA256 ${ROOT}/${SOURCE} HASH)
+		string(APPEND LINES "${HASH}  ${SOURCE}\n")
+	endforeach()
+	set(${OUT} "${LINES}" PARENT_SCOPE)
+endfunction()
+
+#cmake -DROOT=<source dir> -DSTAMP=<file> -DSOURCES=<a|b|...> -P shaderstamp.cmake
+if(CMAKE_SCRIPT_MODE_FILE STREQUAL CMAKE_CURRENT_LIST_FILE)
+	string(REPLACE "|" ";" SOURCES "${SOURCES}")
+	shader_stamp(${ROOT} LINES ${SOURCES})
+	file(WRITE ${STAMP} "${LINES}")
+endif()
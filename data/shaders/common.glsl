@@ -1,5 +1,3 @@
-const float terrainWidth = 256.0;
-const float terrainHeight = 256.0;
 const uint terrainNumVerts = 36u;
 const uint terrainNumIndicies = 36u;
 const float textureWidth = 2048.0;
@@ -68,12 +66,6 @@ struct Light
     vec4 attenuation;
 }; 
 
-struct Atom
-{
-    uint type;
-    uint data;
-};
-
 layout(push_constant) uniform push_constants_t
 {
         uint numLights;
@@ -82,11 +74,11 @@ layout(push_constant) uniform push_constants_t
         float currentTime;
         uint terrainWidth;
         uint terrainHeight;
-        uint reseved6;
-        uint reseved7;
-        uint reseved8;
-        uint reseved9;
-        uint reseved10;
+        uint terrainWindowX;
+        uint terrainWindowY;
+        uint terrainResident;
+        uint gridWidth;
+        uint gridHeight;
         uint reseved11;
         uint reseved12;
         uint reseved13;
@@ -163,6 +155,7 @@ layout (set = 0, binding = 8) buffer readonly lights_t
 	Light lights[];
 };  
 
+//terrain tile shapes and heights, a byte each packed four to a uint like Terrain keeps them on the cpu
 layout (set = 0, binding = 9) buffer readonly tiles_t
 {
 	uint tiles[];
@@ -173,9 +166,57 @@ layout (set = 0, binding = 10) buffer readonly alts_t
 	uint alts[];
 };
 
+uint terrainTile(const uint idx)
+{
+	return (tiles[idx / 4u] >> ((idx % 4u) * 8u)) & 0xffu;
+}
+
+uint terrainAltitude(const uint idx)
+{
+	return (alts[idx / 4u] >> ((idx % 4u) * 8u)) & 0xffu;
+}
+
+//the terrain buffers hold terrainRing x terrainRing slots of terrainChunk x terrainChunk tiles each, a slot after
+//the other. chunk (cx, cy) of the map is always in slot (cx % terrainRing, cy % terrainRing), the window of chunks
+//drawn starts at chunk (terrainWindowX, terrainWindowY) and slot s is only drawn when bit s of terrainResident
+//is set. keep in sync with TerrainStreamer
+const uint terrainChunk = 64u;
+const uint terrainRing = 4u;
+
+//the map position of the tile in instance idx
+uvec2 terrainPosition(const uint idx)
+{
+	const uint cells = terrainChunk * terrainChunk;
+	const uint slot = idx / cells;
+	const uint local = idx % cells;
+	const uvec2 window = uvec2(PushConstants.terrainWindowX, PushConstants.terrainWindowY);
+	const uvec2 s = uvec2(slot % terrainRing, slot / terrainRing);
+	const uvec2 chunk = window + (s + terrainRing - window % terrainRing) % terrainRing;
+	return chunk * terrainChunk + uvec2(local % terrainChunk, local / terrainChunk);
+}
+
+bool terrainVisible(const uint idx)
+{
+	const uvec2 p = terrainPosition(idx);
+	const uint resident = PushConstants.terrainResident >> (idx / (terrainChunk * terrainChunk));
+	return (resident & 1u) != 0u && p.x < PushConstants.terrainWidth && p.y < PushConstants.terrainHeight;
+}
+
+//citygen cells packed like PackedAtom on the cpu, gridCellBits each with the type in the low gridTypeBits.
+//keep in sync with GRID_CELL_BITS and GRID_TYPE_BITS in vulkanrenderer.hpp
+const uint gridCellBits = 8u;
+const uint gridTypeBits = 4u;
+
 layout (set = 0, binding = 11) buffer readonly grid_t
 {
-	Atom grid[];
+	uint grid[];
 };
 
+uint gridType(const uint idx)
+{
+	const uint cellsPerWord = 32u / gridCellBits;
+	const uint word = grid[idx / cellsPerWord];
+	return (word >> ((idx % cellsPerWord) * gridCellBits)) & ((1u << gridTypeBits) - 1u);
+}
+
 layout (set = 0, binding = 12) uniform sampler2D texsamp;
\ No newline at end of file
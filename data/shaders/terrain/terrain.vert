@@ -31,14 +31,27 @@ void main()
 	idx = uint(gl_InstanceIndex);
 	const uint vdx = uint(gl_VertexIndex);
 
-	const uint tile = tiles[idx];
-	const uint alt = alts[idx];
-	grd = grid[idx].type + terrainTextureTileOffset;
+	//tiles of slots that wait for their chunk and tiles past the edge of the map collapse to a point
+	if(!terrainVisible(idx))
+	{
+		grd = 0u;
+		interpolatedNormal = vec3(0.0);
+		interpolatedTexCoord = vec2(0.0);
+		fragPos = vec3(0.0);
+		gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
+		return;
+	}
+
+	const uvec2 pos = terrainPosition(idx);
+	const uint tile = terrainTile(idx);
+	const uint alt = terrainAltitude(idx);
+	const uint gridWidth = PushConstants.gridWidth;
+	grd = (pos.x < gridWidth && pos.y < PushConstants.gridHeight ? gridType(pos.y * gridWidth + pos.x) : 0u) + terrainTextureTileOffset;
 
 	//select proper vert from instanceindex and vertex id
 	vec4 newVert = positions[(tile*terrainNumVerts)+vdx];
-	newVert.x += (mod(idx, terrainWidth));
-	newVert.z += terrainHeight - ( floor(idx / terrainWidth) );
+	newVert.x += float(pos.x);
+	newVert.z += float(PushConstants.terrainHeight) - float(pos.y);
 	newVert.y -= alt;
 
 
@@ -0,0 +1,1035 @@
+#include "game/citygen/atomupdater.hpp"
+#include "game/citygen/checkpoint.hpp"
+#include "game/citygen/cityworker.hpp"
+#include "game/citygen/grid.hpp"
+#include "game/citygen/rules.hpp"
+#include "game/citygen/syncupdater.hpp"
+#include "game/slopes.hpp"
+#include "util/perf_counters.hpp"
+#include "util/slot_table.hpp"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace vkopter::game::citygen;
+
+//seeds a road every 32 cells so the updater has real work to do instead of mostly hitting empty sites
+auto seedGrid(Grid<> &grid) -> void
+{
+    grid.clear();
+    for (int32_t y = 16; y < grid.height(); y += 32) {
+        for (int32_t x = 16; x < grid.width(); x += 32) {
+            grid(x, y, 0) = ((x + y) / 32) % 2 ? RoadNS : RoadEW;
+        }
+    }
+}
+
+//fnv-1a over every atom, equal hashes mean equal cities
+auto gridHash(Grid<> const &grid) -> uint64_t
+{
+    uint64_t h = 14695981039346656037ull;
+    auto const add = [&h](uint32_t const v) {
+        for (int i = 0; i < 4; ++i) {
+            h = (h ^ ((v >> (i * 8)) & 0xff)) * 1099511628211ull;
+        }
+    };
+    for (int32_t z = 0; z < grid.depth(); ++z) {
+        for (int32_t y = 0; y < grid.height(); ++y) {
+            for (int32_t x = 0; x < grid.width(); ++x) {
+                add(grid(x, y, z).type());
+                add(grid(x, y, z).data());
+            }
+        }
+    }
+    return h;
+}
+
+auto report(Grid<> const &grid, char const *mode, uint32_t const threads, uint64_t const events, std::chrono::steady_clock::duration const t) -> void
+{
+    double const s = std::chrono::duration<double>(t).count();
+    std::printf("%5dx%-5d %-8s %3u threads %10llu events %9.2f ms %8.2f Mevents/s\n",
+                grid.width(), grid.height(), mode, threads, static_cast<unsigned long long>(events), s * 1000.0, events / s / 1e6);
+}
+
+auto bench(int32_t const w, int32_t const h, uint64_t const events) -> void
+{
+    using namespace std::chrono;
+
+    auto grid = std::make_unique<Grid<>>(w, h);
+
+    {
+        seedGrid(*grid);
+        AtomUpdater<4> au(*grid);
+        auto const t1 = steady_clock::now();
+        for (uint64_t i = 0; i < events; ++i) {
+            au.updateRnd();
+        }
+        report(*grid, "uniform", 1, events, steady_clock::now() - t1);
+    }
+
+    {
+        seedGrid(*grid);
+        AtomUpdater<4> au(*grid);
+        auto const t1 = steady_clock::now();
+        au.updateSerial(events);
+        report(*grid, "serial", 1, events, steady_clock::now() - t1);
+    }
+
+    uint32_t const hw = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<uint32_t> threadCounts;
+    for (uint32_t t = 1; t < hw; t *= 2) {
+        threadCounts.push_back(t);
+    }
+    threadCounts.push_back(hw);
+
+    for (auto const t : threadCounts) {
+        seedGrid(*grid);
+        AtomUpdater<4> au(*grid);
+        auto const t1 = steady_clock::now();
+        au.updateParallel(events, t);
+        report(*grid, "tiled", t, events, steady_clock::now() - t1);
+    }
+}
+
+//the tiled scheduler has to build the same city from the same seed no matter how many threads run it, and the
+//serial one the same city again
+auto checkDeterminism(int32_t const w, int32_t const h, uint64_t const events, uint64_t const seed) -> bool
+{
+    auto grid = std::make_unique<Grid<>>(w, h);
+
+    seedGrid(*grid);
+    AtomUpdater<4> serial(*grid);
+    serial.seedRNG(seed);
+    serial.updateSerial(events / 2);
+    serial.updateSerial(events - events / 2);
+
+    uint64_t const first = gridHash(*grid);
+    bool same = true;
+    std::printf("%5dx%-5d seed %llu  serial     hash %016llx\n", w, h, static_cast<unsigned long long>(seed),
+                static_cast<unsigned long long>(first));
+
+    for (uint32_t const t : {1u, 2u, 3u, 8u}) {
+        seedGrid(*grid);
+        AtomUpdater<4> au(*grid);
+        au.seedRNG(seed);
+        au.updateParallel(events / 2, t);
+        au.updateParallel(events - events / 2, t);
+
+        uint64_t const hash = gridHash(*grid);
+        same = same && hash == first;
+        std::printf("%5dx%-5d seed %llu %3u threads hash %016llx\n", w, h, static_cast<unsigned long long>(seed),
+                    t, static_cast<unsigned long long>(hash));
+    }
+    std::printf("%s\n", same ? "deterministic" : "NOT DETERMINISTIC");
+    return same;
+}
+
+//the rule window of a site read straight from a copy of the grid
+struct CopyWindow {
+    static constexpr int32_t R = rules::REACH;
+    std::array<Atom, (2 * R + 1) * (2 * R + 1)> cells;
+    Atom sink;
+
+    auto operator()(int32_t const x, int32_t const y, int32_t const z = 0) -> Atom & {
+        if (z != 0) {
+            sink = Empty;
+            return sink;
+        }
+        return cells[(x + R) + (y + R) * (2 * R + 1)];
+    }
+};
+
+//one sync generation computed the plain way, without chunks or halos: every live site runs its rule on a copy
+//of the grid and its writes into Empty cells are resolved with the policy and the streams SyncUpdater uses
+auto referenceStep(Grid<> &grid, uint64_t const seed, uint64_t const generation, Conflict const conflict) -> void
+{
+    constexpr int32_t R = rules::REACH;
+    int32_t const w = grid.width();
+    int32_t const h = grid.height();
+    std::vector<GridCell> before(grid.size());
+    grid.copyRegion(0, 0, 0, w, h, before);
+    auto const at = [&](int32_t const x, int32_t const y) {
+        return x < 0 || y < 0 || x >= w || y >= h ? GridCell{} : before[static_cast<size_t>(y) * w + x];
+    };
+
+    struct Claim {
+        Atom atom;
+        uint64_t priority = 0;
+        bool found = false;
+        bool contested = false;
+    };
+    std::vector<Claim> claims(grid.size());
+
+    for (int32_t y = 0; y < h; ++y) {
+        for (int32_t x = 0; x < w; ++x) {
+            Type const type = at(x, y).type();
+            if (!rules::TARGETS[type]) {
+                continue;
+            }
+
+            CopyWindow ew;
+            for (int32_t dy = -R; dy <= R; ++dy) {
+                for (int32_t dx = -R; dx <= R; ++dx) {
+                    ew(dx, dy) = at(x + dx, y + dy).unpack();
+                }
+            }
+            uint64_t const site = static_cast<uint64_t>(y) * w + x;
+            Rng gen = Rng::stream(seed, generation, site);
+            rules::apply(type, ew, gen);
+            uint64_t const priority = conflict == Conflict::Random ? Rng::stream(seed, generation, site, 1).next() : ~site;
+
+            for (int32_t dy = -R; dy <= R; ++dy) {
+                for (int32_t dx = -R; dx <= R; ++dx) {
+                    Atom const a = ew(dx, dy);
+                    bool const target = rules::TARGETS[type] & rules::target(dx, dy);
+                    if (!target || a.type == Empty || !grid.isInBounds(x + dx, y + dy) || at(x + dx, y + dy).type() != Empty) {
+                        continue;
+                    }
+
+                    Claim &c = claims[static_cast<size_t>(y + dy) * w + x + dx];
+                    if (!c.found) {
+                        c = {a, priority, true, false};
+                        continue;
+                    }
+                    c.contested = c.contested || a != c.atom;
+                    if (priority > c.priority) {
+                        c.atom = a;
+                        c.priority = priority;
+                    }
+                }
+            }
+        }
+    }
+
+    for (int32_t y = 0; y < h; ++y) {
+        for (int32_t x = 0; x < w; ++x) {
+            Claim const &c = claims[static_cast<size_t>(y) * w + x];
+            if (c.found && !(c.contested && conflict == Conflict::Drop)) {
+                grid.set(x, y, 0, c.atom);
+            }
+        }
+    }
+}
+
+//the sync generations have to match referenceStep for every policy and thread count, the cells at chunk
+//borders included. also the run to do under a sanitizer build (VKOPTER_SANITIZE), it reads every halo edge
+auto checkSync(int32_t const w, int32_t const h, uint64_t const steps, uint64_t const seed) -> bool
+{
+    auto reference = std::make_unique<Grid<>>(w, h);
+    auto grid = std::make_unique<Grid<>>(w, h);
+    char const *const names[] = {"random", "lowest", "drop"};
+    bool same = true;
+
+    for (auto const conflict : {Conflict::Random, Conflict::LowestSite, Conflict::Drop}) {
+        seedGrid(*reference);
+        for (uint64_t g = 0; g < steps; ++g) {
+            referenceStep(*reference, seed, g, conflict);
+        }
+        uint64_t const expected = gridHash(*reference);
+
+        for (uint32_t const t : {1u, 3u, 8u}) {
+            seedGrid(*grid);
+            SyncUpdater<> su(*grid, conflict);
+            su.seedRNG(seed);
+            for (uint64_t g = 0; g < steps; ++g) {
+                su.step(t);
+            }
+            uint64_t const hash = gridHash(*grid);
+            same = same && hash == expected;
+            std::printf("%5dx%-5d sync %-6s %3u threads hash %016llx reference %016llx\n", w, h,
+                        names[static_cast<int>(conflict)], t, static_cast<unsigned long long>(hash),
+                        static_cast<unsigned long long>(expected));
+        }
+    }
+    std::printf("%s\n", same ? "sync matches the reference" : "SYNC DIFFERS FROM THE REFERENCE");
+    return same;
+}
+
+//useful events are the ones that changed the grid, the uniform sampler spends most of its events on Empty
+//or finished sites while the active set only ever samples sites that can still grow
+auto benchSampler(int32_t const w, int32_t const h, uint64_t const events) -> void
+{
+    using namespace std::chrono;
+
+    auto grid = std::make_unique<Grid<>>(w, h);
+    auto const start = [&grid]() {
+        grid->clear();
+        (*grid)(16, 16, 0) = RoadNS;
+    };
+
+    {
+        start();
+        AtomUpdater<4> au(*grid);
+        uint64_t useful = 0;
+        auto const t1 = steady_clock::now();
+        for (uint64_t i = 0; i < events; ++i) {
+            useful += au.updateRnd() ? 1 : 0;
+        }
+        double const s = duration<double>(steady_clock::now() - t1).count();
+        std::printf("%5dx%-5d uniform  %10llu events %9.2f ms %10llu useful %12.0f useful/s\n",
+                    w, h, static_cast<unsigned long long>(events), s * 1000.0,
+                    static_cast<unsigned long long>(useful), useful / s);
+    }
+
+    {
+        start();
+        AtomUpdater<4> au(*grid);
+        auto const t1 = steady_clock::now();
+        uint64_t const useful = au.updateActive(events);
+        double const s = duration<double>(steady_clock::now() - t1).count();
+        std::printf("%5dx%-5d active   %10llu events %9.2f ms %10llu useful %12.0f useful/s %8zu live sites\n",
+                    w, h, static_cast<unsigned long long>(events), s * 1000.0,
+                    static_cast<unsigned long long>(useful), useful / s, au.activeSites());
+    }
+}
+
+//cost of one rule evaluation on its own: window, branch and candidate picks, writes into the window.
+//nothing is pasted back so every iteration sees the same Empty neighbourhood and does all of its writes
+auto benchRules(uint64_t const iterations) -> void
+{
+    using namespace std::chrono;
+
+    auto grid = std::make_unique<Grid<>>(64, 64);
+    Rng gen;
+    uint64_t sink = 0;
+
+    for (std::size_t t = 0; t < NUM_TYPES; ++t) {
+        grid->clear();
+        (*grid)(32, 32, 0) = static_cast<Type>(t);
+
+        auto const t1 = steady_clock::now();
+        for (uint64_t i = 0; i < iterations; ++i) {
+            auto ew = grid->viewEW<4, true>(32, 32, 0);
+            rules::apply((*grid)(32, 32, 0).type(), ew, gen);
+            sink += ew.touched().size();
+        }
+        double const s = duration<double>(steady_clock::now() - t1).count();
+        std::printf("rule %2zu %8.2f ns/event\n", t, s * 1e9 / iterations);
+    }
+    std::printf("(%llu cells touched)\n", static_cast<unsigned long long>(sink));
+}
+
+//a city grown from one road in the middle of a huge map, only the chunks it reaches get allocated
+auto benchSparse(int32_t const w, int32_t const h, uint64_t const events) -> void
+{
+    using namespace std::chrono;
+
+    auto grid = std::make_unique<Grid<>>(w, h);
+    (*grid)(w / 2, h / 2, 0) = RoadNS;
+
+    AtomUpdater<4> au(*grid);
+    auto const t1 = steady_clock::now();
+    uint64_t const useful = au.updateActive(events);
+    double const s = duration<double>(steady_clock::now() - t1).count();
+    std::printf("%5dx%-5d sparse   %10llu events %9.2f ms %10llu useful %8zu chunks %9.2f MB (dense %9.2f MB)\n",
+                w, h, static_cast<unsigned long long>(events), s * 1000.0, static_cast<unsigned long long>(useful),
+                grid->allocatedChunks(), grid->memoryBytes() / 1e6, grid->size() * sizeof(GridCell) / 1e6);
+}
+
+//share of the grid that is not Empty
+auto coverage(Grid<> const &grid) -> double
+{
+    std::vector<GridCell> row(grid.width());
+    uint64_t used = 0;
+    for (int32_t y = 0; y < grid.height(); ++y) {
+        grid.copyRegion(0, y, 0, grid.width(), 1, row);
+        used += std::count_if(row.begin(), row.end(), [](GridCell const c) { return static_cast<bool>(c); });
+    }
+    return static_cast<double>(used) / grid.size();
+}
+
+//time the async tiled scheduler and the sync generations each take to grow the seeded grid to the same coverage.
+//coverage is checked after every quarter sweep or generation, outside of the timing
+auto benchCoverage(int32_t const w, int32_t const h, double const target, uint32_t const threads) -> void
+{
+    using namespace std::chrono;
+
+    auto grid = std::make_unique<Grid<>>(w, h);
+
+    {
+        seedGrid(*grid);
+        AtomUpdater<4> au(*grid);
+        au.seedRNG(1);
+        uint64_t const batch = grid->size() / 4;
+        uint64_t events = 0;
+        steady_clock::duration t{};
+        while (coverage(*grid) < target && events < grid->size() * 1000) {
+            auto const t1 = steady_clock::now();
+            au.updateParallel(batch, threads);
+            t += steady_clock::now() - t1;
+            events += batch;
+        }
+        std::printf("%5dx%-5d async    %3u threads %5.1f%% coverage %9.2f ms %12llu events\n", w, h, threads, coverage(*grid) * 100.0,
+                    duration<double, std::milli>(t).count(), static_cast<unsigned long long>(events));
+    }
+
+    for (auto const conflict : {Conflict::Random, Conflict::LowestSite, Conflict::Drop}) {
+        seedGrid(*grid);
+        SyncUpdater<> su(*grid, conflict);
+        su.seedRNG(1);
+        steady_clock::duration t{};
+        bool growing = true;
+        while (coverage(*grid) < target && growing) {
+            auto const t1 = steady_clock::now();
+            growing = su.step(threads) > 0;
+            t += steady_clock::now() - t1;
+        }
+        char const *const names[] = {"random", "lowest", "drop"};
+        std::printf("%5dx%-5d sync     %3u threads %5.1f%% coverage %9.2f ms %12llu generations (%s)\n", w, h, threads,
+                    coverage(*grid) * 100.0, duration<double, std::milli>(t).count(),
+                    static_cast<unsigned long long>(su.generation()), names[static_cast<int>(conflict)]);
+    }
+}
+
+//what updateGrid in the renderer uploads per frame with dirty tracking, replayed into a mirror of the gpu
+//buffer that has to end up equal to the grid
+auto benchUpload(int32_t const w, int32_t const h, uint64_t const eventsPerFrame, uint32_t const frames) -> bool
+{
+    using namespace std::chrono;
+
+    auto grid = std::make_unique<Grid<>>(w, h);
+    seedGrid(*grid);
+    AtomUpdater<4> au(*grid);
+
+    auto const count = static_cast<size_t>(w) * h;
+    std::vector<GridCell> mirror(count);
+    grid->consumeDirty([](int32_t, int32_t, int32_t, int32_t) {});
+    grid->copyRegion(0, 0, 0, w, h, mirror);
+
+    std::vector<GridCell> staging;
+    uint64_t bytes = 0;
+    uint64_t copies = 0;
+    steady_clock::duration packing{};
+    for (uint32_t f = 0; f < frames; ++f) {
+        for (uint64_t e = 0; e < eventsPerFrame; ++e) {
+            au.updateRnd();
+        }
+
+        auto const t1 = steady_clock::now();
+        staging.clear();
+        size_t lastEnd = SIZE_MAX;
+        grid->consumeDirty([&](int32_t const x, int32_t const y, int32_t, int32_t const runWidth) {
+            int32_t const n = std::min(x + runWidth, w) - x;
+            staging.resize(staging.size() + n);
+            grid->copyRegion(x, y, 0, n, 1, std::span(staging).last(n));
+            size_t const dst = static_cast<size_t>(y) * w + x;
+            std::copy_n(staging.end() - n, n, mirror.begin() + dst);
+            copies += dst != lastEnd;
+            lastEnd = dst + n;
+        });
+        packing += steady_clock::now() - t1;
+        bytes += staging.size() * sizeof(GridCell);
+    }
+
+    std::vector<GridCell> full(count);
+    grid->copyRegion(0, 0, 0, w, h, full);
+    bool const same = std::equal(full.begin(), full.end(), mirror.begin(),
+                                 [](GridCell const a, GridCell const b) { return a.raw() == b.raw(); });
+
+    std::printf("%5dx%-5d upload   %6llu events/frame %8.0f bytes/frame (full %9zu) %7.1f copies/frame %7.2f us/frame %s\n",
+                w, h, static_cast<unsigned long long>(eventsPerFrame), static_cast<double>(bytes) / frames, count * sizeof(GridCell),
+                static_cast<double>(copies) / frames, duration<double, std::micro>(packing).count() / frames,
+                same ? "matches" : "MISMATCH");
+    return same;
+}
+
+//saves a grown city, loads it back whole and one chunk of it at a time, and checks that growing on from the loaded
+//checkpoint gives the same city as growing on from the original
+auto benchCheckpoint(int32_t const w, int32_t const h, uint64_t const events) -> bool
+{
+    using namespace std::chrono;
+
+    std::string const path = (std::filesystem::temp_directory_path() / "citybench.ckpt").string();
+    auto grid = std::make_unique<Grid<>>(w, h);
+    seedGrid(*grid);
+    AtomUpdater<4> au(*grid);
+    au.seedRNG(3);
+    au.updateParallel(events, 1);
+    for (int32_t i = 0; i < 1000; ++i) {
+        au.updateRnd();
+    }
+
+    auto const t1 = steady_clock::now();
+    Checkpoint<>::save(*grid, au.state(), path);
+    auto const t2 = steady_clock::now();
+
+    auto loaded = std::make_unique<Grid<>>(w, h);
+    AtomUpdater<4> restored(*loaded);
+    auto const t3 = steady_clock::now();
+    Checkpoint<> const checkpoint(path);
+    checkpoint.load(*loaded);
+    restored.restore(checkpoint.updaterState());
+    auto const t4 = steady_clock::now();
+    bool const same = gridHash(*grid) == gridHash(*loaded);
+
+    //one chunk at a time from a freshly opened file, what streaming a region in costs
+    auto streamed = std::make_unique<Grid<>>(w, h);
+    auto const t5 = steady_clock::now();
+    Checkpoint<> const again(path);
+    size_t const records = again.loadRegion(*streamed, w / 2, h / 2, 0, Grid<>::CHUNK_SIZE, Grid<>::CHUNK_SIZE);
+    auto const t6 = steady_clock::now();
+
+    for (auto *const a : {&au, &restored}) {
+        a->updateParallel(events / 4, 1);
+        for (int32_t i = 0; i < 1000; ++i) {
+            a->updateRnd();
+        }
+    }
+    bool const continued = gridHash(*grid) == gridHash(*loaded);
+    std::filesystem::remove(path);
+
+    std::printf("%5dx%-5d ckpt     %9zu B file (grid %9zu B) save %7.2f ms load %7.2f ms region %7.3f ms (%zu chunk) %s %s\n",
+                w, h, checkpoint.fileBytes(), grid->memoryBytes(), duration<double, std::milli>(t2 - t1).count(),
+                duration<double, std::milli>(t4 - t3).count(), duration<double, std::milli>(t6 - t5).count(), records,
+                same ? "matches" : "MISMATCH", continued ? "continues" : "DIVERGES");
+    return same && continued;
+}
+
+//a CityWorker growing the city at eventsPerSecond while this thread plays the renderer, polling for deltas every
+//frame and applying them to a mirror. what a frame costs should not depend on the rate, and the mirror has to
+//end up equal to the grid once the worker stopped and the rest was handed over
+auto benchWorker(int32_t const w, int32_t const h, uint64_t const eventsPerSecond, uint32_t const frames) -> bool
+{
+    using namespace std::chrono;
+
+    auto grid = std::make_unique<Grid<>>(w, h);
+    seedGrid(*grid);
+    AtomUpdater<4> au(*grid);
+    au.seedRNG(4);
+
+    std::vector<GridCell> mirror(static_cast<size_t>(w) * h);
+    auto const apply = [&](GridDelta<> const &d) {
+        for (auto const &r : d.runs) {
+            std::copy_n(d.cells.begin() + r.first, r.w, mirror.begin() + static_cast<size_t>(r.y) * w + r.x);
+        }
+    };
+
+    CityWorker city(*grid, au, eventsPerSecond);
+    steady_clock::duration total{};
+    steady_clock::duration worst{};
+    uint64_t deltas = 0;
+    uint64_t cells = 0;
+    city.start();
+    for (uint32_t f = 0; f < frames; ++f) {
+        auto const t1 = steady_clock::now();
+        if (auto const *const d = city.latest()) {
+            apply(*d);
+            ++deltas;
+            cells += d->cells.size();
+        }
+        auto const t = steady_clock::now() - t1;
+        total += t;
+        worst = std::max(worst, t);
+        std::this_thread::sleep_for(milliseconds(2));
+    }
+    city.stop();
+    while (auto const *const d = city.latest()) {
+        apply(*d);
+    }
+
+    std::vector<GridCell> full(mirror.size());
+    grid->copyRegion(0, 0, 0, w, h, full);
+    bool const same = std::equal(full.begin(), full.end(), mirror.begin(),
+                                 [](GridCell const a, GridCell const b) { return a.raw() == b.raw(); });
+
+    std::printf("%5dx%-5d worker   %9llu events/s %10llu events %6llu deltas %9.0f cells/delta %7.2f us/frame (worst %8.2f) %s\n",
+                w, h, static_cast<unsigned long long>(eventsPerSecond), static_cast<unsigned long long>(city.events()),
+                static_cast<unsigned long long>(deltas), deltas ? static_cast<double>(cells) / deltas : 0.0,
+                duration<double, std::micro>(total).count() / frames, duration<double, std::micro>(worst).count(),
+                same ? "matches" : "MISMATCH");
+    return same;
+}
+
+//grows a city with occupancy counts kept on the way and checks them against a recount and against scanning,
+//then times "how many road cells within radius r" with and without the pyramid
+auto benchOccupancy(int32_t const w, int32_t const h, uint64_t const events) -> bool
+{
+    using namespace std::chrono;
+
+    TypeSet const roads = TypeSet::range(RoadNS, RoadNSW);
+    std::array<TypeSet, 3> const sets = {roads, TypeSet{Grass}, TypeSet{Empty, RoadEW}};
+
+    double grown[2];
+    auto grid = std::make_unique<Grid<>>(w, h);
+    for (bool const counted : {false, true}) {
+        seedGrid(*grid);
+        if (counted) {
+            grid->enableOccupancy();
+        } else {
+            grid->disableOccupancy();
+        }
+        AtomUpdater<4> au(*grid);
+        au.seedRNG(5);
+        auto const t1 = steady_clock::now();
+        au.updateParallel(events, 1);
+        grown[counted] = duration<double, std::milli>(steady_clock::now() - t1).count();
+    }
+
+    Rng rng(6);
+    struct Query {
+        int32_t x, y, r;
+        size_t set;
+        uint64_t n;
+    };
+    std::vector<Query> queries(2000);
+    for (auto &q : queries) {
+        q = {rng.range(-16, w + 16), rng.range(-16, h + 16), rng.range(0, 300), rng.below(3), 0};
+        q.n = grid->count(sets[q.set], q.x - q.r, q.y - q.r, 2 * q.r + 1, 2 * q.r + 1);
+    }
+
+    auto const check = [&] {
+        return std::all_of(queries.begin(), queries.end(), [&](Query const &q) {
+            return grid->count(sets[q.set], q.x - q.r, q.y - q.r, 2 * q.r + 1, 2 * q.r + 1) == q.n;
+        });
+    };
+    grid->enableOccupancy();
+    bool const recounted = check();
+    grid->disableOccupancy();
+    bool const scanned = check();
+
+    std::printf("%5dx%-5d occupancy grow %9.2f ms (without %9.2f ms) %s %s\n", w, h, grown[1], grown[0],
+                recounted ? "recount matches" : "recount MISMATCH", scanned ? "scan matches" : "scan MISMATCH");
+
+    for (int32_t const r : {8, 64, 256}) {
+        double us[2];
+        double anyUs = 0.0;
+        uint64_t sink = 0;
+        for (bool const counted : {false, true}) {
+            if (counted) {
+                grid->enableOccupancy();
+            }
+            int32_t const n = counted ? 100000 : std::max(10, 2000000 / ((2 * r + 1) * (2 * r + 1)));
+            Rng pick(7);
+            auto const t1 = steady_clock::now();
+            for (int32_t i = 0; i < n; ++i) {
+                int32_t const x = pick.range(0, w - 1);
+                int32_t const y = pick.range(0, h - 1);
+                sink += grid->count(roads, x - r, y - r, 2 * r + 1, 2 * r + 1);
+            }
+            us[counted] = duration<double, std::micro>(steady_clock::now() - t1).count() / n;
+        }
+
+        //"is there a road within r", what rules ask most
+        Rng pick(7);
+        auto const t1 = steady_clock::now();
+        for (int32_t i = 0; i < 100000; ++i) {
+            int32_t const x = pick.range(0, w - 1);
+            int32_t const y = pick.range(0, h - 1);
+            sink += grid->any(roads, x - r, y - r, 2 * r + 1, 2 * r + 1);
+        }
+        anyUs = duration<double, std::micro>(steady_clock::now() - t1).count() / 100000;
+
+        std::printf("%5dx%-5d occupancy radius %4d %9.3f us/count (scan %9.3f us/count) %9.3f us/any%s\n", w, h, r, us[1], us[0],
+                    anyUs, sink ? "" : " ");
+        grid->disableOccupancy();
+    }
+    return recounted && scanned;
+}
+
+//noise over a few broad hills, the noisy half of the tiles is what the slope solvers have to cut down
+auto benchSlopes(int32_t const w, int32_t const h, uint32_t const threads) -> bool
+{
+    using namespace std::chrono;
+    using vkopter::game::solveSlopes;
+    using vkopter::game::sweepSlopes;
+
+    constexpr uint32_t BORDER = 255;
+
+    Vector2d<uint32_t> source(w, h);
+    Rng rng(8);
+    for (int32_t y = 0; y < h; ++y) {
+        for (int32_t x = 0; x < w; ++x) {
+            double const hills = 96.0 + 64.0 * std::sin(x * 0.01) * std::cos(y * 0.013);
+            source(x, y) = static_cast<uint32_t>(hills) + (rng.below(2) ? rng.below(160) : 0);
+        }
+    }
+
+    //every tile at most one above its four neighbours and the border, and never above where it started
+    auto const valid = [&](Vector2d<uint32_t> &m) {
+        for (int32_t y = 0; y < h; ++y) {
+            for (int32_t x = 0; x < w; ++x) {
+                uint32_t const v = m(x, y);
+                bool const raised = v > source(x, y);
+                bool const border = (x == 0 || x == w - 1) && v > BORDER + 1;
+                bool const left = x > 0 && v > m(x - 1, y) + 1;
+                bool const right = x < w - 1 && v > m(x + 1, y) + 1;
+                bool const up = y > 0 && v > m(x, y - 1) + 1;
+                bool const down = y < h - 1 && v > m(x, y + 1) + 1;
+                if (raised || border || left || right || up || down) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    };
+
+    auto const time = [&](Vector2d<uint32_t> &m, auto const &solve) {
+        m = source;
+        auto const t1 = steady_clock::now();
+        solve(m);
+        return duration<double, std::milli>(steady_clock::now() - t1).count();
+    };
+
+    Vector2d<uint32_t> swept;
+    Vector2d<uint32_t> solved;
+    double const sweepMs = time(swept, [](auto &m) { sweepSlopes(m, BORDER); });
+    double const oneMs = time(solved, [](auto &m) { solveSlopes(m, BORDER, 1); });
+    bool same = std::equal(swept.data(), swept.data() + swept.getSize(), solved.data());
+    double const manyMs = time(solved, [threads](auto &m) { solveSlopes(m, BORDER, threads); });
+    same = same && std::equal(swept.data(), swept.data() + swept.getSize(), solved.data());
+    bool const ok = same && valid(solved);
+
+    std::printf("%5dx%-5d slopes sweep %9.2f ms solve %9.2f ms (%u threads %9.2f ms) %s\n", w, h, sweepMs, oneMs, threads,
+                manyMs, ok ? "matches" : "MISMATCH");
+    return ok;
+}
+
+//one configured run of the harness
+struct Run {
+    int32_t w = 256;
+    int32_t h = 256;
+    uint64_t seed = Rng::DEFAULT_SEED;
+    char const *mode = "tiled";
+    uint32_t threads = 1;
+    uint64_t events = 1000000;
+    uint64_t steps = 100;
+    Conflict conflict = Conflict::Random;
+    uint32_t repeat = 1;
+    bool csv = false;
+};
+
+//runs the updater on a freshly seeded grid repeat times and reports the fastest run, the hash is the same every
+//time since every repeat starts from the same grid and seed. an event of the sync mode is one cell in one generation
+auto runOnce(Run const &r) -> uint64_t
+{
+    using namespace std::chrono;
+
+    auto grid = std::make_unique<Grid<>>(r.w, r.h);
+    PerfCounters counters;
+    steady_clock::duration best = steady_clock::duration::max();
+    std::optional<std::array<uint64_t, PerfCounters::NUM_COUNTERS>> bestCounts;
+    uint64_t useful = 0;
+    std::string_view const mode = r.mode;
+
+    for (uint32_t i = 0; i < r.repeat; ++i) {
+        seedGrid(*grid);
+        AtomUpdater<4> au(*grid);
+        au.seedRNG(r.seed);
+        useful = 0;
+
+        counters.start();
+        auto const t1 = steady_clock::now();
+        if (mode == "serial") {
+            useful = au.updateSerial(r.events);
+        } else if (mode == "active") {
+            useful = au.updateActive(r.events);
+        } else if (mode == "sync") {
+            SyncUpdater<> su(*grid, r.conflict);
+            su.seedRNG(r.seed);
+            for (uint64_t g = 0; g < r.steps; ++g) {
+                useful += su.step(r.threads);
+            }
+        } else {
+            useful = au.updateParallel(r.events, r.threads);
+        }
+        auto const t = steady_clock::now() - t1;
+        counters.stop();
+
+        if (t < best) {
+            best = t;
+            bestCounts = counters.read();
+        }
+    }
+
+    double const s = duration<double>(best).count();
+    double const events = static_cast<double>(mode == "sync" ? r.steps * grid->size() : r.events);
+    uint64_t const hash = gridHash(*grid);
+
+    //counters are per event, n/a (or empty fields) where perf_event_open is not allowed
+    char counts[128] = "";
+    if (bestCounts) {
+        auto const per = [&](PerfCounters::Counter const c) { return (*bestCounts)[c] / events; };
+        double const cycles = static_cast<double>((*bestCounts)[PerfCounters::Cycles]);
+        double const ipc = cycles > 0 ? (*bestCounts)[PerfCounters::Instructions] / cycles : 0.0;
+        std::snprintf(counts, sizeof(counts), r.csv ? "%.2f,%.2f,%.3f,%.3f,%.2f" : "%7.1f cyc/ev %7.1f ins/ev %6.3f ref/ev %6.3f miss/ev ipc %4.2f",
+                      per(PerfCounters::Cycles), per(PerfCounters::Instructions), per(PerfCounters::CacheReferences),
+                      per(PerfCounters::CacheMisses), ipc);
+    } else {
+        std::snprintf(counts, sizeof(counts), "%s", r.csv ? ",,,," : "counters n/a");
+    }
+
+    char const *format = r.csv ?
+        "%d,%d,%s,%u,%llu,%llu,%.3f,%.3f,%.3f,%llu,%zu,%zu,%s,%016llx\n" :
+        "%5dx%-5d %-6s %3u thr seed %-9llu %10llu ev %9.2f ms %8.2f Mev/s %7.2f ns/ev %10llu useful %6zu chunks %9zu B"
+        " | %s | hash %016llx\n";
+    std::printf(format, r.w, r.h, r.mode, r.threads, static_cast<unsigned long long>(r.seed),
+                static_cast<unsigned long long>(events), s * 1000.0, events / s / 1e6, s * 1e9 / events,
+                static_cast<unsigned long long>(useful), grid->allocatedChunks(), grid->memoryBytes(), counts,
+                static_cast<unsigned long long>(hash));
+    return hash;
+}
+
+//the fixed set of benchmarks every citygen change gets compared with
+//random inserts, erases and lookups on the SlotTable the memory manager keeps its allocations in, against a map.
+//handles are also kept after their value is erased, those have to find nothing and erase nothing
+auto checkSlotTable(uint64_t const ops) -> bool
+{
+    SlotTable<uint64_t> table;
+    std::map<std::pair<uint32_t, uint32_t>, uint64_t> reference;
+    std::vector<SlotHandle> handles;
+    Rng gen(7);
+    bool same = true;
+
+    for (uint64_t i = 0; i < ops && same; ++i) {
+        uint32_t const op = gen.below(10);
+        if (op < 4 || handles.empty()) {
+            SlotHandle const h = table.insert(i);
+            same = reference.emplace(std::pair{h.index, h.generation}, i).second;
+            handles.push_back(h);
+            continue;
+        }
+
+        SlotHandle const h = handles[gen.below(static_cast<uint32_t>(handles.size()))];
+        auto const it = reference.find({h.index, h.generation});
+        if (op < 7) {
+            same = table.erase(h) == (it != reference.end());
+            if (it != reference.end()) {
+                reference.erase(it);
+            }
+        } else {
+            uint64_t const *const v = table.get(h);
+            same = it == reference.end() ? v == nullptr : v != nullptr && *v == it->second;
+        }
+
+        //the dense values and their handles have to be exactly what the map holds
+        if (same && (i % 65536 == 0 || i + 1 == ops)) {
+            same = table.size() == reference.size();
+            for (size_t d = 0; d < table.size() && same; ++d) {
+                SlotHandle const owner = table.handle(d);
+                auto const found = reference.find({owner.index, owner.generation});
+                same = found != reference.end() && found->second == *(table.begin() + d);
+            }
+        }
+    }
+    std::printf("slot table %llu ops %zu values %zu handles %s\n", static_cast<unsigned long long>(ops), table.size(),
+                handles.size(), same ? "matches the map" : "DIFFERS FROM THE MAP");
+    return same;
+}
+
+auto suite() -> bool
+{
+    bool const deterministic = checkDeterminism(256, 256, 1000000, 1) && checkDeterminism(1024, 1024, 4000000, 2);
+    bool const synced = checkSync(256, 256, 40, 1) && checkSync(1024, 1024, 40, 2);
+    bool const slots = checkSlotTable(1000000);
+
+    benchRules(10000000);
+
+    benchSampler(256, 256, 1000000);
+    benchSampler(1024, 1024, 1000000);
+    benchSparse(16384, 16384, 10000000);
+
+    bool const uploaded = benchUpload(256, 256, 1000, 1000) && benchUpload(2048, 2048, 1000, 1000);
+    bool const checkpoints = benchCheckpoint(256, 256, 1000000) && benchCheckpoint(2048, 2048, 16000000);
+    bool const counted = benchOccupancy(1024, 1024, 8000000);
+    uint32_t const cores = std::max(1u, std::thread::hardware_concurrency());
+    bool const sloped = benchSlopes(1024, 1024, cores) && benchSlopes(4096, 4096, cores) && benchSlopes(8192, 4096, cores);
+    bool const handedOver = benchWorker(256, 256, 60000, 250) && benchWorker(256, 256, 4000000, 250) &&
+                            benchWorker(2048, 2048, 4000000, 250);
+
+    benchCoverage(256, 256, 0.15, 1);
+    benchCoverage(1024, 1024, 0.15, 1);
+    if (std::thread::hardware_concurrency() > 1) {
+        benchCoverage(1024, 1024, 0.15, std::thread::hardware_concurrency());
+    }
+
+    bench(256, 256, 1000000);
+    bench(1024, 1024, 16000000);
+    bench(2048, 2048, 64000000);
+
+    return deterministic && synced && slots && uploaded && checkpoints && handedOver && counted && sloped;
+}
+
+auto usage() -> void
+{
+    std::printf("citybench                       the fixed suite\n"
+                "citybench [options]             every combination of\n"
+                "  --size WxH[,WxH...]           grid sizes (256x256)\n"
+                "  --seed S[,S...]               rng seeds (the default seed)\n"
+                "  --mode M[,M...]               serial, tiled, active or sync schedulers (tiled)\n"
+                "  --threads T[,T...]            thread counts of tiled and sync runs (1)\n"
+                "  --events N                    events per run (1000000)\n"
+                "  --steps N                     generations per sync run (100)\n"
+                "  --conflict random|lowest|drop how sync runs resolve writes into the same cell (random)\n"
+                "  --repeat R                    runs of which the fastest is reported (1)\n"
+                "  --expect HASH                 fail unless every run ends with this grid hash\n"
+                "  --csv                         comma separated output\n"
+                "serial and tiled runs of the same size and seed have to end with the same hash, tiled and sync runs\n"
+                "for any thread count, the exit code is nonzero if they do not or if --expect does not match\n");
+}
+
+auto split(std::string_view s) -> std::vector<std::string_view>
+{
+    std::vector<std::string_view> parts;
+    while (!s.empty()) {
+        auto const comma = s.find(',');
+        parts.push_back(s.substr(0, comma));
+        s = comma == std::string_view::npos ? std::string_view{} : s.substr(comma + 1);
+    }
+    return parts;
+}
+
+auto number(std::string_view const s, int const base = 10) -> uint64_t
+{
+    uint64_t v = 0;
+    auto const [end, ec] = std::from_chars(s.data(), s.data() + s.size(), v, base);
+    if (ec != std::errc{} || end != s.data() + s.size()) {
+        throw std::invalid_argument("not a number: " + std::string(s));
+    }
+    return v;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        return suite() ? 0 : 1;
+    }
+
+    std::vector<std::pair<int32_t, int32_t>> sizes = {{256, 256}};
+    std::vector<uint64_t> seeds = {Rng::DEFAULT_SEED};
+    std::vector<std::string> modes = {"tiled"};
+    std::vector<uint32_t> threads = {1};
+    Run base;
+    std::optional<uint64_t> expect;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string_view const arg = argv[i];
+            auto const value = [&]() -> std::string_view {
+                if (i + 1 >= argc) {
+                    throw std::invalid_argument("missing value for " + std::string(arg));
+                }
+                return argv[++i];
+            };
+
+            if (arg == "--size") {
+                sizes.clear();
+                for (auto const sz : split(value())) {
+                    auto const x = sz.find('x');
+                    if (x == std::string_view::npos) {
+                        throw std::invalid_argument("size is WxH: " + std::string(sz));
+                    }
+                    sizes.emplace_back(static_cast<int32_t>(number(sz.substr(0, x))), static_cast<int32_t>(number(sz.substr(x + 1))));
+                }
+            } else if (arg == "--seed") {
+                seeds.clear();
+                for (auto const sd : split(value())) {
+                    seeds.push_back(number(sd));
+                }
+            } else if (arg == "--mode") {
+                modes.clear();
+                for (auto const m : split(value())) {
+                    if (m != "serial" && m != "tiled" && m != "active" && m != "sync") {
+                        throw std::invalid_argument("unknown mode: " + std::string(m));
+                    }
+                    modes.emplace_back(m);
+                }
+            } else if (arg == "--threads") {
+                threads.clear();
+                for (auto const t : split(value())) {
+                    threads.push_back(static_cast<uint32_t>(number(t)));
+                }
+            } else if (arg == "--events") {
+                base.events = number(value());
+            } else if (arg == "--steps") {
+                base.steps = number(value());
+            } else if (arg == "--conflict") {
+                std::string_view const c = value();
+                if (c == "random") {
+                    base.conflict = Conflict::Random;
+                } else if (c == "lowest") {
+                    base.conflict = Conflict::LowestSite;
+                } else if (c == "drop") {
+                    base.conflict = Conflict::Drop;
+                } else {
+                    throw std::invalid_argument("unknown conflict policy: " + std::string(c));
+                }
+            } else if (arg == "--repeat") {
+                base.repeat = std::max<uint32_t>(1, static_cast<uint32_t>(number(value())));
+            } else if (arg == "--expect") {
+                expect = number(value(), 16);
+            } else if (arg == "--csv") {
+                base.csv = true;
+            } else {
+                usage();
+                return arg == "--help" || arg == "-h" ? 0 : 2;
+            }
+        }
+    } catch (std::invalid_argument const &e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        usage();
+        return 2;
+    }
+
+    if (base.csv) {
+        std::printf("width,height,mode,threads,seed,events,ms,mevents_per_s,ns_per_event,useful,chunks,bytes,"
+                    "cycles_per_event,instructions_per_event,cache_refs_per_event,cache_misses_per_event,ipc,hash\n");
+    }
+
+    bool ok = true;
+    for (auto const &[w, h] : sizes) {
+        for (auto const seed : seeds) {
+            //serial is the tiled schedule on one thread, both have to build the same city
+            std::optional<uint64_t> scheduleHash;
+            for (auto const &mode : modes) {
+                bool const threaded = mode == "tiled" || mode == "sync";
+                std::optional<uint64_t> threadedHash;
+                for (auto const t : threaded ? threads : std::vector<uint32_t>{1}) {
+                    Run r = base;
+                    r.w = w;
+                    r.h = h;
+                    r.seed = seed;
+                    r.mode = mode.c_str();
+                    r.threads = t;
+
+                    uint64_t const hash = runOnce(r);
+                    if (expect && hash != *expect) {
+                        std::fprintf(stderr, "%dx%d %s %u threads seed %llu: hash %016llx, expected %016llx\n", w, h, r.mode, t,
+                                     static_cast<unsigned long long>(seed), static_cast<unsigned long long>(hash),
+                                     static_cast<unsigned long long>(*expect));
+                        ok = false;
+                    }
+                    if (threadedHash && hash != *threadedHash) {
+                        std::fprintf(stderr, "%dx%d seed %llu: %u threads built a different city\n", w, h,
+                                     static_cast<unsigned long long>(seed), t);
+                        ok = false;
+                    }
+                    threadedHash = hash;
+
+                    if (mode == "serial" || mode == "tiled") {
+                        if (scheduleHash && hash != *scheduleHash) {
+                            std::fprintf(stderr, "%dx%d seed %llu: serial and tiled runs built different cities\n", w, h,
+                                         static_cast<unsigned long long>(seed));
+                            ok = false;
+                        }
+                        scheduleHash = hash;
+                    }
+                }
+            }
+        }
+    }
+    return ok ? 0 : 1;
+}
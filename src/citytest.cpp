@@ -10,7 +10,7 @@
 class AtomRenderer
 {
 public:
-    explicit AtomRenderer(vkopter::game::citygen::Grid<256, 256, 1> &g)
+    explicit AtomRenderer(vkopter::game::citygen::Grid<> &g)
         : grid(g)
     {
         using namespace std;
@@ -51,10 +51,10 @@ public:
         if (duration_cast<milliseconds>(t2 - t1).count() > 16) {
             SDL_RenderClear(ren);
 
-            for (auto x = 0; x < grid.WIDTH; ++x) {
-                for (auto y = 0; y < grid.HEIGHT; ++y) {
+            for (auto x = 0; x < grid.width(); ++x) {
+                for (auto y = 0; y < grid.height(); ++y) {
                     SDL_Rect dst{x * IMAGE_SIZE, y * IMAGE_SIZE, (IMAGE_SIZE), (IMAGE_SIZE)};
-                    SDL_RenderCopy(ren, images[grid(x, y, 0).type], nullptr, &dst);
+                    SDL_RenderCopy(ren, images[grid(x, y, 0).type()], nullptr, &dst);
                 }
             }
 
@@ -67,7 +67,7 @@ public:
     }
 
 private:
-    vkopter::game::citygen::Grid<256, 256, 1> &grid;
+    vkopter::game::citygen::Grid<> &grid;
 
     SDL_Window *win;
     SDL_Renderer *ren;
@@ -80,8 +80,8 @@ int main(int argc, char **argv)
 {
     SDL_Init(SDL_INIT_EVERYTHING);
 
-    vkopter::game::citygen::Grid<256, 256, 1> grid;
-    vkopter::game::citygen::AtomUpdater<256, 256, 1, 4> au(grid);
+    vkopter::game::citygen::Grid<> grid(256, 256);
+    vkopter::game::citygen::AtomUpdater<4> au(grid);
 
     AtomRenderer ar(grid);
 
@@ -1,8 +1,9 @@
 #pragma once
 
+#include <cassert>
+#include <concepts>
 #include <cstdint>
 #include <vector>
-#include <random>
 #include <ranges>
 
 
@@ -55,31 +56,6 @@ public:
         return *this;
     }
 
-    auto operator = (std::ranges::range auto atoms) -> Atom&
-    {
-        static thread_local std::minstd_rand gen(std::random_device{}());
-
-        auto s = 0ul;
-        for(auto itr = atoms.begin(); itr!= atoms.end(); ++itr)
-        {
-            ++s;
-        }
-        std::uniform_int_distribution<size_t> dis{0,s-1};
-        auto r = dis(gen);
-        s = 0;
-        for(auto itr = atoms.begin(); itr!= atoms.end(); ++itr)
-        {
-            if(r == s)
-            {
-                (*this) = (*itr);
-            }
-            ++s;
-        }
-
-        return (*this);
-
-    }
-
     auto operator << (const Atom& that) -> Atom&
     {
         if(type == Empty)
@@ -98,35 +74,6 @@ public:
         return *this;
     }
 
-    auto operator << (std::ranges::range auto atoms) -> Atom&
-    {
-
-        if(type != Type::Empty) { return (*this); }
-
-        static thread_local std::minstd_rand gen(std::random_device{}());
-
-        auto s = 0ul;
-        for(auto itr = atoms.begin(); itr!= atoms.end(); ++itr)
-        {
-            ++s;
-        }
-        std::uniform_int_distribution<size_t> dis{0,s-1};
-        auto const r = dis(gen);
-        s = 0;
-        for(auto itr = atoms.begin(); itr != atoms.end(); ++itr)
-        {
-            if(r == s)
-            {
-                (*this) = (*itr);
-                return (*this);
-            }
-            ++s;
-        }
-
-        return (*this);
-
-    }
-
     auto operator == (const Atom& that) const -> bool
     {
         if(that.type == type)
@@ -203,4 +150,82 @@ private:
 
 };
 
+//the in-grid form of an Atom, TYPE_BITS of type with the rest of the word left for data.
+//the grid stores these and only rules and event windows see full Atoms, so a 4096x4096 city in the
+//default byte cells is 16MB instead of 128MB
+template<std::unsigned_integral Word = uint8_t, uint8_t TYPE_BITS = 4>
+class PackedAtom
+{
+public:
+    using word_type = Word;
+
+    static constexpr uint8_t BITS = sizeof(Word) * 8;
+    static_assert(TYPE_BITS <= BITS, "type bits have to fit the word");
+    static_assert(TYPE_BITS <= 32, "Type itself is only 32 bits");
+    static_assert(NUM_TYPES <= (uint64_t{1} << TYPE_BITS), "not enough type bits for every Type");
+
+    static constexpr uint8_t TYPE_WIDTH = TYPE_BITS;
+    static constexpr uint8_t DATA_BITS = BITS - TYPE_BITS;
+    static constexpr Word TYPE_MASK = static_cast<Word>((uint64_t{1} << TYPE_BITS) - 1);
+
+    PackedAtom() = default;
+
+    PackedAtom(Atom const & a)
+    {
+        (*this) = a;
+    }
+
+    [[nodiscard]] auto type() const -> Type
+    {
+        return static_cast<Type>(bits_ & TYPE_MASK);
+    }
+
+    [[nodiscard]] auto data() const -> uint32_t
+    {
+        if constexpr (DATA_BITS == 0) { return 0; }
+        else { return bits_ >> TYPE_BITS; }
+    }
+
+    [[nodiscard]] auto unpack() const -> Atom
+    {
+        return Atom{type(), data()};
+    }
+
+    [[nodiscard]] auto raw() const -> Word
+    {
+        return bits_;
+    }
+
+    //data that does not fit DATA_BITS is cut off
+    auto operator = (Atom const & a) -> PackedAtom&
+    {
+        assert(DATA_BITS >= 32 || a.data < (uint64_t{1} << DATA_BITS));
+        if constexpr (DATA_BITS == 0) { bits_ = static_cast<Word>(a.type); }
+        else { bits_ = static_cast<Word>(static_cast<Word>(a.type) | (static_cast<Word>(a.data) << TYPE_BITS)); }
+        return *this;
+    }
+
+    auto operator = (Type const & t) -> PackedAtom&
+    {
+        bits_ = static_cast<Word>((bits_ & ~TYPE_MASK) | t);
+        return *this;
+    }
+
+    auto operator == (Type const & t) const -> bool
+    {
+        return type() == t;
+    }
+
+    operator bool () const
+    {
+        return type() != Empty;
+    }
+
+private:
+    Word bits_ = 0;
+};
+
+//what a Grid stores unless told otherwise
+using GridCell = PackedAtom<>;
+
 }
@@ -3,28 +3,40 @@
 #include "eventwindow.hpp"
 
 #include "grid.hpp"
+#include "rng.hpp"
+#include "rules.hpp"
+#include "siteset.hpp"
+#include <algorithm>
+#include <atomic>
+#include <barrier>
+#include <cassert>
 #include <chrono>
 #include <cstdint>
-#include <random>
+#include <span>
+#include <thread>
+#include <vector>
 
 namespace vkopter::game::citygen
 {
 
-template<uint64_t W, uint64_t H, uint64_t D, uint64_t S>
+//PLANAR updaters are for grids with depth 1, they never look at z
+template<uint64_t S, bool PLANAR = true, class Cell = GridCell>
 class AtomUpdater
 {
 public:
-   explicit AtomUpdater(Grid<W,H,D>& g) :
+   using GridType = Grid<Cell>;
+   using Window = typename GridType::template Window<S, PLANAR>;
+
+   explicit AtomUpdater(GridType& g) :
        grid_(g),
-       dis_percent_(0,100),
-       dis_ew_(-EventWindow<S>::SIZE,EventWindow<S>::SIZE),
-       dis_grid_x_(0,grid_.WIDTH-1),
-       dis_grid_y_(0,grid_.HEIGHT-1),
-       dis_grid_z_(0,grid_.DEPTH-1),
-       dis_bool_(0,1),
-       funcs_(get_funcs()),
-       gen_(87735410)
+       width_(g.width()),
+       height_(g.height()),
+       depth_(g.depth()),
+       gen_(seed_)
    {
+       assert(!PLANAR || depth_ == 1);
+       //the active set keeps sites as 32 bit indices, which holds for every grid Grid allows
+       assert(g.size() <= UINT32_MAX);
    }
 
    AtomUpdater(AtomUpdater&) = default;
@@ -34,344 +46,368 @@ public:
    ~AtomUpdater() = default;
 
 
-   auto update(int32_t const x, int32_t const y, int32_t const z = 0) -> void
+   //returns true when the event changed the grid
+   auto update(int32_t const x, int32_t const y, int32_t const z = 0) -> bool
    {
-       if(grid_(x,y,z).type)
-       {
-           EventWindow<S> ew = grid_.template copyEW<S>(x,y,z);
-           (this->*(funcs_[grid_(x,y,z).type])) (ew);
-           grid_.template pasteEW<S>(ew,x,y,z);
-
-       }
-
-       //std::cout << "update from thread: " << std::this_thread::get_id() << "\n";
+       active_valid_ = false;
+       return update(x,y,z,gen_);
    }
 
-   auto updateRnd() -> void
+   //one event at a site drawn uniformly over the whole grid, from the updater's own generator. this does not
+   //follow the tile schedule, a city grown this way is not the one updateSerial() or updateParallel() build
+   auto updateRnd() -> bool
    {
-       update( rndGridX(),rndGridY(),rndGridZ() );
+       return update( rndGridX(),rndGridY(),rndGridZ() );
    }
 
-
-   auto seedRNG(unsigned long s = 0) -> void
+   //alternative to updateRnd() that only samples live sites: sites whose rule still has an Empty cell to write to.
+   //every other site is a no-op for the rules, so this is the same asynchronous CA with the wasted events
+   //skipped, one call here stands for about grid size / activeSites() calls to updateRnd().
+   //the set is rebuilt on first use and after any other update, call resetActiveSites() after editing the grid directly.
+   //returns the number of events that changed the grid, stops early once no live site is left
+   auto updateActive(uint64_t const events) -> uint64_t
    {
-       if(s == 0)
+       if(!active_valid_) { rebuildActiveSites(); }
+
+       uint64_t changes = 0;
+       for(uint64_t i = 0; i < events && !active_.empty(); ++i)
        {
-           s = std::chrono::high_resolution_clock::now().time_since_epoch().count();
+           uint32_t const site = active_[gen_.below(static_cast<uint32_t>(active_.size()))];
+           auto const w = static_cast<uint32_t>(width_);
+           auto const h = static_cast<uint32_t>(height_);
+           auto const x = static_cast<int32_t>(site % w);
+           auto const y = static_cast<int32_t>((site / w) % h);
+           auto const z = static_cast<int32_t>(site / (w * h));
+
+           auto ew = grid_.template viewEW<S, PLANAR>(x,y,z);
+           rules::apply(grid_.get(x,y,z).type(), ew, gen_);
+           grid_.pasteEW(ew);
+
+           bool changed = false;
+           for(auto const & t : ew.touched())
+           {
+               if(t.inside && t.cur.type != t.old.type)
+               {
+                   changed = true;
+                   auto const p = ew.positionOf(t);
+                   refreshActiveAround(p[0], p[1], p[2]);
+               }
+           }
+           changes += changed ? 1 : 0;
        }
-       gen_.seed(s);
+       return changes;
    }
 
-   auto isOverlaping(int32_t const x1, int32_t const y1, int32_t const z1,
-                     int32_t const x2, int32_t const y2, int32_t const z2) -> bool
+   auto resetActiveSites() -> void
    {
-       return (x1 + S >= x2 - S) &&
-            (x1 - S <= x2 + S) &&
-            (y1 + S >= y2 - S) &&
-            (y1 - S <= y2 + S) &&
-            (z1 + S >= z2 - S) &&
-            (z1 - S <= z2 + S);
-   };
-
-
+       active_valid_ = false;
+   }
 
+   [[nodiscard]] auto activeSites() const -> size_t
+   {
+       return active_.size();
+   }
 
-private:
+   //runs roughly the same number of events as calling updateRnd() that many times, but spread over threads.
+   //the grid is cut into tiles at least 2*S wide and coloured like a checkerboard, tiles of one colour are
+   //updated concurrently (their event windows can never overlap), with a barrier between colours.
+   //every tile draws from its own stream keyed on (seed, call, round, tile), so the resulting grid only depends
+   //on the seed and the sequence of calls, never on the number of threads. updateSerial() is the same schedule
+   //on one thread and takes its place in the sequence of calls.
+   //returns how many events changed the grid
+   auto updateParallel(uint64_t const events, uint32_t threads = 0) -> uint64_t
+   {
+       if(events == 0) { return 0; }
+       active_valid_ = false;
 
-    Grid<W,H,D>& grid_;
+       auto const phases = tilePhases();
+       uint64_t numTiles = 0;
+       size_t widestPhase = 1;
+       for(auto const & p : phases)
+       {
+           numTiles += p.size();
+           widestPhase = std::max(widestPhase, p.size());
+       }
 
-   std::minstd_rand gen_;
-   std::uniform_int_distribution<int> dis_bool_;
-   std::uniform_int_distribution<int> dis_percent_;
-   std::uniform_int_distribution<int> dis_ew_;
-   std::uniform_int_distribution<int> dis_grid_x_;
-   std::uniform_int_distribution<int> dis_grid_y_;
-   std::uniform_int_distribution<int> dis_grid_z_;
+       if(threads == 0) { threads = std::thread::hardware_concurrency(); }
+       threads = std::clamp<uint32_t>(threads, 1, static_cast<uint32_t>(widestPhase));
 
-   std::array< void (AtomUpdater::*)(EventWindow<S>&), NUM_TYPES > funcs_;
+       uint64_t const call = parallel_calls_++;
+       uint64_t const perRound = numTiles * MAX_EVENTS_PER_TILE;
+       uint64_t const rounds = (events + perRound - 1) / perRound;
+       //its own key, stream(seed_, call) would be the stream of the first tile in the first round
+       uint64_t const firstTile = Rng::stream(seed_, call, UINT64_MAX).below(static_cast<uint32_t>(numTiles));
 
+       std::barrier sync(threads);
+       std::atomic<uint64_t> useful = 0;
 
-////////////////////////////////////////////////////////////
+       auto worker = [&](uint32_t const w)
+       {
+           uint64_t remaining = events;
+           uint64_t changed = 0;
+           //the tiles that get one event more than the others move on every round and start somewhere else
+           //every call, calls with fewer events than tiles would only ever reach the first tiles otherwise
+           uint64_t rotate = firstTile;
 
-   //consts for CA
-   int const static INTERSECTION_CHANCE = 7;
+           for(uint64_t r = 0; r < rounds; ++r)
+           {
+               uint64_t const roundEvents = std::min(remaining, perRound);
+               uint64_t const base = roundEvents / numTiles;
+               uint64_t const extra = roundEvents % numTiles;
+
+               uint64_t tileIndex = 0;
+               for(auto const & p : phases)
+               {
+                   for(size_t t = w; t < p.size(); t += threads)
+                   {
+                       uint64_t const n = base + ((tileIndex + t + rotate) % numTiles < extra ? 1 : 0);
+                       Rng gen = Rng::stream(seed_, call, r, tileIndex + t);
+                       changed += updateTile(p[t], n, gen);
+                   }
+                   tileIndex += p.size();
+                   sync.arrive_and_wait();
+               }
+
+               remaining -= roundEvents;
+               rotate += extra;
+           }
+           useful.fetch_add(changed, std::memory_order_relaxed);
+       };
 
-   auto coin() -> bool
-   {
-       return dis_bool_(gen_);
+       std::vector<std::jthread> pool;
+       pool.reserve(threads - 1);
+       for(uint32_t w = 1; w < threads; ++w)
+       {
+           pool.emplace_back(worker, w);
+       }
+       worker(0);
+       pool.clear();
+       return useful.load(std::memory_order_relaxed);
    }
 
-   auto rndPercent(const int p) -> bool
-   {
-       const int n = dis_percent_(gen_);
-       return n <= p;
-   }
 
-   auto rndNum(const int a, const int b) -> int
+   //the serial run of updateParallel(): the same tiles get the same events from the same streams, one tile after
+   //the other on the calling thread. a serial and a parallel run with the same seed build the same city
+   auto updateSerial(uint64_t const events) -> uint64_t
    {
-       std::uniform_int_distribution<int> d(a,b);
-       return d(gen_);
+       return updateParallel(events, 1);
    }
 
-   auto rndEW() -> int32_t
+   //same seed and same sequence of calls gives the same city, 0 picks a seed from the clock
+   auto seedRNG(uint64_t s = 0) -> void
    {
-       return dis_ew_(gen_);
+       if(s == 0)
+       {
+           s = std::chrono::high_resolution_clock::now().time_since_epoch().count();
+       }
+       seed_ = s;
+       gen_ = Rng(seed_);
+       parallel_calls_ = 0;
    }
 
-   auto rndGridX() -> int32_t
+   [[nodiscard]] auto state() const -> UpdaterState
    {
-       return dis_grid_x_(gen_);
+       return {seed_, gen_.state(), parallel_calls_};
    }
 
-   auto rndGridY() -> int32_t
+   //continues the sequence of calls a state() was taken from, e.g. after loading a checkpoint of the grid
+   auto restore(UpdaterState const & s) -> void
    {
-       return dis_grid_y_(gen_);
+       seed_ = s.seed;
+       gen_ = Rng::fromState(s.rng);
+       parallel_calls_ = s.calls;
+       active_valid_ = false;
    }
 
-   auto rndGridZ() -> int32_t
+   auto isOverlaping(int32_t const x1, int32_t const y1, int32_t const z1,
+                     int32_t const x2, int32_t const y2, int32_t const z2) const -> bool
    {
-       return dis_grid_z_(gen_);
-   }
-
+       constexpr auto s = static_cast<int32_t>(S);
+       return (x1 + s >= x2 - s) &&
+            (x1 - s <= x2 + s) &&
+            (y1 + s >= y2 - s) &&
+            (y1 - s <= y2 + s) &&
+            (z1 + s >= z2 - s) &&
+            (z1 - s <= z2 + s);
+   };
 
-   auto f00(EventWindow<S>& ew) -> void
-   {
 
-   }
-   auto f01(EventWindow<S>& ew) -> void
-   {
 
-   }
-   auto f02(EventWindow<S>& ew) -> void
-   {
-       //return;
-       //ew.siteMemory(0,0,0,0);
-       //first thing, fix road, as it might not actually be what it says RN
-       bool fixed = false;
 
-       auto EWtypes = {RoadEW, RoadEWN, RoadEWS, Road4Way};
-       //if(ew(1,0) == EWtypes)
-       {
+private:
 
-       }
+    GridType& grid_;
+   int32_t width_;
+   int32_t height_;
+   int32_t depth_;
 
-       if(fixed) {return;}
+   uint64_t seed_ = Rng::DEFAULT_SEED;
+   Rng gen_;
+   uint64_t parallel_calls_ = 0;
 
-       int cx = 0, cy = 1;
-       bool const lookNorth = coin();
-       if(lookNorth) { cy = -1; }
-       bool const inter = rndPercent(INTERSECTION_CHANCE);
+   SiteSet active_;
+   bool active_valid_ = false;
 
-       auto possibleTypes = {RoadNS};
 
-       if(lookNorth && inter)
-       {
-           possibleTypes = {RoadDiagBL, RoadDiagBR, Road4Way, RoadEWS, RoadNSE, RoadNSW};
+////////////////////////////////////////////////////////////
 
-       }
-       if(!lookNorth && inter)
-       {
-           possibleTypes = {RoadDiagTL, RoadDiagTR, Road4Way, RoadEWN, RoadNSE, RoadNSW};
-       }
-       ew(cx,cy) << possibleTypes;
+   //consts for the parallel scheduler, a site is at least TILE_SIZE - S away from what same coloured tiles
+   //write, which has to cover the radius of Window::countAround()
+   static constexpr int32_t TILE_SIZE = std::max<int32_t>(Window::MAX_AROUND + S, 16);
+   static_assert(TILE_SIZE >= 2 * S);
+   static constexpr uint64_t MAX_EVENTS_PER_TILE = 64;
 
-   }
-   auto f03(EventWindow<S>& ew) -> void
+   struct Tile
    {
-       int cx = 1, cy = 0;
-       bool const lookWest = coin();
-       if(lookWest) { cx = -1; }
-       bool const inter = rndPercent(INTERSECTION_CHANCE);
-
-       auto possibleTypes = {RoadEW};
+       int32_t x, y, z;
+       int32_t w, h, d;
+   };
 
-       if(lookWest && inter)
-       {
-           possibleTypes = {RoadDiagBR, RoadDiagTR, Road4Way, RoadEWN, RoadEWS, RoadNSE};
-       }
-       if(!lookWest && inter)
-       {
-           possibleTypes = {RoadDiagBL, RoadDiagTL, Road4Way, RoadEWN, RoadEWS, RoadNSW};
-       }
-       ew(cx,cy) << possibleTypes;
-   }
-   auto f04(EventWindow<S>& ew) -> void
+   auto update(int32_t const x, int32_t const y, int32_t const z, Rng& gen) -> bool
    {
-       //look south or west
-       int cx = -1, cy = 0;
-       bool const lookSouth = coin();
-       if(lookSouth) { cx = 0; cy = 1; }
-
-       bool const inter = rndPercent(INTERSECTION_CHANCE);
-       if(lookSouth)
-       {
-           if(inter)
-           {
-
-               ew(cx,cy) << RoadNS;
-           }
-           else
-           {
-               ew(cx,cy) << RoadDiagTR;
-           }
-       }
-       else
+       Type const type = grid_.get(x,y,z).type();
+       if(type)
        {
-           if(inter)
-           {
+           auto ew = grid_.template viewEW<S, PLANAR>(x,y,z);
+           rules::apply(type, ew, gen);
+           grid_.pasteEW(ew);
 
-               ew(cx,cy) << RoadEW;
-           }
-           else
+           for(auto const & t : ew.touched())
            {
-               ew(cx,cy) << RoadDiagTR;
+               if(t.inside && t.cur.type != t.old.type) { return true; }
            }
        }
-
+       return false;
    }
-   auto f05(EventWindow<S>& ew) -> void
+
+   auto isLive(int32_t const x, int32_t const y, int32_t const z) -> bool
    {
-       //look south or east
-       int cx=1,cy = 0;
-       bool const lookSouth = coin();
-       if(lookSouth) { cx = 0; cy = 1; }
+       uint32_t const targets = rules::TARGETS[grid_.get(x,y,z).type()];
+       if(targets == 0) { return false; }
 
-       bool const inter = rndPercent(INTERSECTION_CHANCE);
-       if(lookSouth)
+       for(int32_t nz = std::max<int32_t>(z - rules::REACH, 0); nz <= std::min<int32_t>(z + rules::REACH, depth_ - 1); ++nz)
        {
-           if(inter)
-           {
-
-               ew(cx,cy) << RoadNS;
-           }
-           else
+           for(int32_t ny = std::max<int32_t>(y - rules::REACH, 0); ny <= std::min<int32_t>(y + rules::REACH, height_ - 1); ++ny)
            {
-               ew(cx,cy) << RoadDiagTL;
+               for(int32_t nx = std::max<int32_t>(x - rules::REACH, 0); nx <= std::min<int32_t>(x + rules::REACH, width_ - 1); ++nx)
+               {
+                   if((targets & rules::target(nx - x, ny - y, nz - z)) && grid_.get(nx,ny,nz).type() == Empty) { return true; }
+               }
            }
        }
-       else
-       {
-           if(inter)
-           {
+       return false;
+   }
 
-               ew(cx,cy) << RoadEW;
-           }
-           else
+   //chunks that were never written to are all Empty and can not hold a live site
+   auto rebuildActiveSites() -> void
+   {
+       constexpr int32_t C = GridType::CHUNK_SIZE;
+       active_.reset(grid_.size());
+       for(int32_t z = 0; z < depth_; ++z)
+       {
+           for(int32_t cy = 0; cy < height_; cy += C)
            {
-               ew(cx,cy) << RoadDiagTL;
+               for(int32_t cx = 0; cx < width_; cx += C)
+               {
+                   if(!grid_.hasChunk(cx,cy,z)) { continue; }
+
+                   for(int32_t y = cy; y < std::min(cy + C, height_); ++y)
+                   {
+                       for(int32_t x = cx; x < std::min(cx + C, width_); ++x)
+                       {
+                           if(isLive(x,y,z)) { active_.insert(siteIndex(x,y,z)); }
+                       }
+                   }
+               }
            }
        }
+       active_valid_ = true;
    }
-   auto f06(EventWindow<S>& ew) -> void
+
+   //in 64 bits, a grid of more than 2^31 cells overflows int32 on the way to an index that fits 32 bits
+   [[nodiscard]] auto siteIndex(int32_t const x, int32_t const y, int32_t const z) const -> uint32_t
    {
-       //look north or east
-       int cx=1,cy=0;
-       bool const lookNorth = coin();
-       if(lookNorth) { cx = 0; cy = -1; }
+       uint64_t const w = static_cast<uint64_t>(width_);
+       return static_cast<uint32_t>(x + w * (y + static_cast<uint64_t>(height_) * z));
+   }
 
-       bool const inter = rndPercent(INTERSECTION_CHANCE);
-       if(lookNorth)
+   //a cell that changed can become live itself and can take the last Empty cell away from its neighbours
+   auto refreshActiveAround(int32_t const x, int32_t const y, int32_t const z) -> void
+   {
+       for(int32_t nz = std::max<int32_t>(z - rules::REACH, 0); nz <= std::min<int32_t>(z + rules::REACH, depth_ - 1); ++nz)
        {
-           if(inter)
-           {
-
-               ew(cx,cy) << RoadNS;
-           }
-           else
+           for(int32_t ny = std::max<int32_t>(y - rules::REACH, 0); ny <= std::min<int32_t>(y + rules::REACH, height_ - 1); ++ny)
            {
-               ew(cx,cy) << RoadDiagBL;
+               for(int32_t nx = std::max<int32_t>(x - rules::REACH, 0); nx <= std::min<int32_t>(x + rules::REACH, width_ - 1); ++nx)
+               {
+                   uint32_t const n = siteIndex(nx,ny,nz);
+                   if(isLive(nx,ny,nz)) { active_.insert(n); }
+                   else { active_.erase(n); }
+               }
            }
        }
-       else
-       {
-           if(inter)
-           {
+   }
 
-               ew(cx,cy) << RoadEW;
-           }
-           else
-           {
-               ew(cx,cy) << RoadDiagBL;
-           }
+   auto updateTile(Tile const & t, uint64_t const n, Rng& gen) -> uint64_t
+   {
+       uint64_t changed = 0;
+       for(uint64_t i = 0; i < n; ++i)
+       {
+           int32_t const x = t.x + gen.below(t.w);
+           int32_t const y = t.y + gen.below(t.h);
+           int32_t const z = PLANAR ? 0 : t.z + gen.below(t.d);
+           changed += update(x, y, z, gen) ? 1 : 0;
        }
+       return changed;
    }
-   auto f07(EventWindow<S>& ew) -> void
+
+   //groups the tiles by checkerboard colour, only the last tile along an axis can be narrower than TILE_SIZE
+   //and it is never the one separating two tiles of the same colour
+   auto tilePhases() const -> std::vector<std::vector<Tile>>
    {
-       //look north or west
-       int cx=-1,cy=0;
-       bool const lookNorth = coin();
-       if(lookNorth) { cx = 0; cy = -1; }
+       assert(!isOverlaping(TILE_SIZE - 1, 0, 0, 2 * TILE_SIZE, 0, 0));
 
-       bool const inter = rndPercent(INTERSECTION_CHANCE);
-       if(lookNorth)
-       {
-           if(inter)
-           {
+       auto const tiles = [](int32_t const extent) { return (extent + TILE_SIZE - 1) / TILE_SIZE; };
+       int32_t const tx = tiles(width_);
+       int32_t const ty = tiles(height_);
+       int32_t const tz = tiles(depth_);
 
-               ew(cx,cy) << RoadNS;
-           }
-           else
-           {
-               ew(cx,cy) << RoadDiagBR;
-           }
-       }
-       else
+       std::vector<std::vector<Tile>> phases(8);
+       for(int32_t z = 0; z < tz; ++z)
        {
-           if(inter)
-           {
-
-               ew(cx,cy) << RoadEW;
-           }
-           else
+           for(int32_t y = 0; y < ty; ++y)
            {
-               ew(cx,cy) << RoadDiagBR;
+               for(int32_t x = 0; x < tx; ++x)
+               {
+                   Tile t;
+                   t.x = x * TILE_SIZE;
+                   t.y = y * TILE_SIZE;
+                   t.z = z * TILE_SIZE;
+                   t.w = std::min<int32_t>(TILE_SIZE, width_ - t.x);
+                   t.h = std::min<int32_t>(TILE_SIZE, height_ - t.y);
+                   t.d = std::min<int32_t>(TILE_SIZE, depth_ - t.z);
+                   phases[(x & 1) | ((y & 1) << 1) | ((z & 1) << 2)].push_back(t);
+               }
            }
        }
+
+       std::erase_if(phases, [](auto const & p) { return p.empty(); });
+       return phases;
    }
-   auto f08(EventWindow<S>& ew) -> void
-   {
-       ew(-1,0) << RoadEW;
-       ew(1,0) << RoadEW;
-       ew(0,1) << RoadNS;
-       ew(0,-1) << RoadNS;
-   }
-   auto f09(EventWindow<S>& ew) -> void
-   {
-       ew(1,0) << RoadEW;
-       ew(-1,0) << RoadEW;
-       ew(0,-1) << RoadNS;
-   }
-   auto f10(EventWindow<S>& ew) -> void
-   {
-       ew(1,0) << RoadEW;
-       ew(-1,0) << RoadEW;
-       ew(0,1) << RoadNS;
-   }
-   auto f11(EventWindow<S>& ew) -> void
+
+   auto rndGridX() -> int32_t
    {
-       ew(0,-1) << RoadNS;
-       ew(0,1) << RoadNS;
-       ew(1,0) << RoadEW;
+       return gen_.below(width_);
    }
-   auto f12(EventWindow<S>& ew) -> void
+
+   auto rndGridY() -> int32_t
    {
-       ew(0,-1) << RoadNS;
-       ew(0,1) << RoadNS;
-       ew(-1,0) << RoadEW;
+       return gen_.below(height_);
    }
 
-//////////////////////////////////////////////////////////////////
-
-
-   static constexpr auto get_funcs() -> std::array<void (AtomUpdater<W,H,D,S>::*)(EventWindow<S> &), NUM_TYPES>
+   auto rndGridZ() -> int32_t
    {
-           return
-           {
-               &AtomUpdater::f00,&AtomUpdater::f01,&AtomUpdater::f02,&AtomUpdater::f03,
-               &AtomUpdater::f04,&AtomUpdater::f05,&AtomUpdater::f06,&AtomUpdater::f07,
-               &AtomUpdater::f08,&AtomUpdater::f09,&AtomUpdater::f10,&AtomUpdater::f11,
-               &AtomUpdater::f12
-           };
+       return PLANAR ? 0 : gen_.below(depth_);
    }
 
 
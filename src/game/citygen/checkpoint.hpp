@@ -0,0 +1,298 @@
+#pragma once
+
+#include "grid.hpp"
+#include "rng.hpp"
+#include "util/mapped_file.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace vkopter::game::citygen
+{
+
+//binary snapshot of a Grid and the state of the updater that grew it, so a generated city is loaded instead of
+//grown again. the file is little endian and every part of it is 8 byte aligned:
+//  Header
+//  one ChunkEntry per chunk of the grid, in the order of the grid, offset 0 for chunks that do not exist
+//  the records of the chunks that do: their cells, then every site memory layer they have
+//each part of a record is stored raw or run length coded, whichever is smaller, raw parts are copied straight
+//out of the mapping. opening only reads the header and the table, loadRegion() only the records it needs, so
+//a part of a large city can be streamed in without reading the rest of the file
+template<class Cell = GridCell>
+class Checkpoint
+{
+public:
+    using GridType = Grid<Cell>;
+
+    static constexpr uint32_t VERSION = 1;
+
+    static_assert(std::is_trivially_copyable_v<Cell>, "cells are copied to and from the file as bytes");
+    static_assert(std::endian::native == std::endian::little, "the file is read in place");
+
+    explicit Checkpoint(std::string const & filename) :
+        file_(filename)
+    {
+        if(file_.size() < sizeof(Header)) { throw std::runtime_error("checkpoint is truncated!"); }
+        std::memcpy(&header_, file_.data(), sizeof(Header));
+
+        if(header_.magic != MAGIC || header_.version != VERSION) { throw std::runtime_error("not a citygen checkpoint!"); }
+        if(header_.cellBytes != sizeof(Cell) || header_.typeBits != Cell::TYPE_WIDTH || header_.chunkBits != GridType::CHUNK_BITS)
+        {
+            throw std::runtime_error("checkpoint was written with another cell layout!");
+        }
+        if(header_.width <= 0 || header_.height <= 0 || header_.depth <= 0 ||
+           header_.chunks != chunksX() * chunksY() * static_cast<uint64_t>(header_.depth) ||
+           header_.chunks > (file_.size() - sizeof(Header)) / sizeof(ChunkEntry))
+        {
+            throw std::runtime_error("checkpoint is truncated!");
+        }
+    }
+
+    [[nodiscard]] auto width() const -> int32_t { return header_.width; }
+    [[nodiscard]] auto height() const -> int32_t { return header_.height; }
+    [[nodiscard]] auto depth() const -> int32_t { return header_.depth; }
+
+    //hand it to restore() of the updater to go on exactly where the saved one stopped
+    [[nodiscard]] auto updaterState() const -> UpdaterState { return header_.updater; }
+
+    //bytes of the file, which is all that a full load reads
+    [[nodiscard]] auto fileBytes() const -> size_t { return file_.size(); }
+
+    //the grid has to have the size of the checkpoint, its chunks are replaced by the ones in the file
+    auto load(GridType & grid) const -> size_t
+    {
+        return loadRegion(grid, 0, 0, 0, header_.width, header_.height, header_.depth);
+    }
+
+    //replaces every chunk of the grid that overlaps the box with the one in the file and returns how many
+    //records were read. the rest of the grid and the rest of the file stay untouched
+    auto loadRegion(GridType & grid, int32_t const x, int32_t const y, int32_t const z,
+                    int32_t const w, int32_t const h, int32_t const d = 1) const -> size_t
+    {
+        if(grid.width() != header_.width || grid.height() != header_.height || grid.depth() != header_.depth)
+        {
+            throw std::runtime_error("checkpoint has another grid size!");
+        }
+
+        for(uint8_t l = 0; l < GridType::NUM_SITE_LAYERS; ++l)
+        {
+            if((header_.layers >> l) & 1) { grid.enableLayer(static_cast<typename GridType::SiteLayer>(l)); }
+        }
+
+        constexpr int32_t C = GridType::CHUNK_SIZE;
+        int32_t const x0 = std::max(x, 0) / C;
+        int32_t const y0 = std::max(y, 0) / C;
+        int32_t const z0 = std::max(z, 0);
+        int32_t const x1 = std::min(x + w, header_.width);
+        int32_t const y1 = std::min(y + h, header_.height);
+        int32_t const z1 = std::min(z + d, header_.depth);
+
+        size_t records = 0;
+        for(int32_t cz = z0; cz < z1; ++cz)
+        {
+            for(int32_t cy = y0; cy * C < y1; ++cy)
+            {
+                for(int32_t cx = x0; cx * C < x1; ++cx)
+                {
+                    ChunkEntry const e = entry(cx, cy, cz);
+                    grid.releaseChunk(cx * C, cy * C, cz);
+                    if(e.offset == 0) { continue; }
+
+                    std::byte const * p = file_.data() + e.offset;
+                    std::byte const * const end = p + e.bytes;
+                    p = decode(p, end, e.rle & 1, grid.writeChunk(cx * C, cy * C, cz), GridType::CHUNK_CELLS);
+                    for(uint8_t l = 0; l < GridType::NUM_SITE_LAYERS; ++l)
+                    {
+                        if(!((e.layers >> l) & 1)) { continue; }
+                        auto const layer = static_cast<typename GridType::SiteLayer>(l);
+                        p = decode(p, end, (e.rle >> (l + 1)) & 1, grid.writeChunkLayer(layer, cx * C, cy * C, cz), GridType::CHUNK_CELLS);
+                    }
+                    grid.recountChunk(cx * C, cy * C, cz);
+                    ++records;
+                }
+            }
+        }
+        return records;
+    }
+
+    //writes the grid and the state of its updater, take the updater state before the next update
+    static auto save(GridType const & grid, UpdaterState const & state, std::string const & filename) -> void
+    {
+        constexpr int32_t C = GridType::CHUNK_SIZE;
+
+        Header header{};
+        header.magic = MAGIC;
+        header.version = VERSION;
+        header.cellBytes = sizeof(Cell);
+        header.typeBits = Cell::TYPE_WIDTH;
+        header.chunkBits = GridType::CHUNK_BITS;
+        header.width = grid.width();
+        header.height = grid.height();
+        header.depth = grid.depth();
+        for(uint8_t l = 0; l < GridType::NUM_SITE_LAYERS; ++l)
+        {
+            header.layers |= grid.hasLayer(static_cast<typename GridType::SiteLayer>(l)) ? 1u << l : 0u;
+        }
+        header.updater = state;
+
+        int32_t const chunksX = (grid.width() + C - 1) / C;
+        int32_t const chunksY = (grid.height() + C - 1) / C;
+        std::vector<ChunkEntry> table(static_cast<size_t>(chunksX) * chunksY * grid.depth());
+        header.chunks = table.size();
+
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+        if(!file.is_open()) { throw std::runtime_error("failed to open file!"); }
+        file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+        file.write(reinterpret_cast<char const *>(table.data()), static_cast<std::streamsize>(table.size() * sizeof(ChunkEntry)));
+
+        uint64_t offset = sizeof(Header) + table.size() * sizeof(ChunkEntry);
+        std::vector<std::byte> record;
+        for(int32_t z = 0; z < grid.depth(); ++z)
+        {
+            for(int32_t cy = 0; cy < chunksY; ++cy)
+            {
+                for(int32_t cx = 0; cx < chunksX; ++cx)
+                {
+                    Cell const * const cells = grid.chunkCells(cx * C, cy * C, z);
+                    if(!cells) { continue; }
+
+                    ChunkEntry& e = table[(static_cast<size_t>(z) * chunksY + cy) * chunksX + cx];
+                    record.clear();
+                    e.rle = encode(cells, GridType::CHUNK_CELLS, record) ? 1 : 0;
+                    for(uint8_t l = 0; l < GridType::NUM_SITE_LAYERS; ++l)
+                    {
+                        uint8_t const * const layer = grid.chunkLayer(static_cast<typename GridType::SiteLayer>(l), cx * C, cy * C, z);
+                        if(!layer) { continue; }
+                        e.layers |= static_cast<uint8_t>(1u << l);
+                        e.rle |= encode(layer, GridType::CHUNK_CELLS, record) ? static_cast<uint8_t>(2u << l) : 0;
+                    }
+
+                    e.offset = offset;
+                    e.bytes = static_cast<uint32_t>(record.size());
+                    record.resize((record.size() + 7) & ~size_t(7));
+                    file.write(reinterpret_cast<char const *>(record.data()), static_cast<std::streamsize>(record.size()));
+                    offset += record.size();
+                }
+            }
+        }
+
+        file.seekp(sizeof(Header));
+        file.write(reinterpret_cast<char const *>(table.data()), static_cast<std::streamsize>(table.size() * sizeof(ChunkEntry)));
+        if(!file) { throw std::runtime_error("failed to write checkpoint!"); }
+    }
+
+private:
+    static constexpr std::array<char, 8> MAGIC = {'V', 'K', 'C', 'I', 'T', 'Y', '\0', '\0'};
+
+    struct Header
+    {
+        std::array<char, 8> magic;
+        uint32_t version;
+        uint32_t cellBytes;
+        uint32_t typeBits;
+        uint32_t chunkBits;
+        int32_t width;
+        int32_t height;
+        int32_t depth;
+        uint32_t layers; //bit l set when the grid had site memory layer l enabled
+        UpdaterState updater;
+        uint64_t chunks;
+    };
+
+    struct ChunkEntry
+    {
+        uint64_t offset = 0;
+        uint32_t bytes = 0;
+        uint8_t layers = 0; //bit l set when the record has site memory layer l
+        uint8_t rle = 0;    //bit 0 for the cells, bit l+1 for layer l, set when that part is run length coded
+        uint16_t unused = 0;
+    };
+
+    static_assert(sizeof(Header) == 80 && sizeof(ChunkEntry) == 16, "the layout is part of the file format");
+
+    MappedFile file_;
+    Header header_;
+
+    [[nodiscard]] auto chunksX() const -> uint64_t { return (static_cast<uint64_t>(header_.width) + GridType::CHUNK_MASK) >> GridType::CHUNK_BITS; }
+    [[nodiscard]] auto chunksY() const -> uint64_t { return (static_cast<uint64_t>(header_.height) + GridType::CHUNK_MASK) >> GridType::CHUNK_BITS; }
+
+    [[nodiscard]] auto entry(int32_t const cx, int32_t const cy, int32_t const cz) const -> ChunkEntry
+    {
+        ChunkEntry e;
+        uint64_t const i = (cz * chunksY() + cy) * chunksX() + cx;
+        std::memcpy(&e, file_.data() + sizeof(Header) + i * sizeof(ChunkEntry), sizeof(e));
+
+        uint64_t const records = sizeof(Header) + header_.chunks * sizeof(ChunkEntry);
+        if(e.offset != 0 && (e.offset < records || e.offset % 8 != 0 || e.bytes > file_.size() - std::min<uint64_t>(e.offset, file_.size())))
+        {
+            throw std::runtime_error("checkpoint is corrupt!");
+        }
+        return e;
+    }
+
+    //runs are a 16 bit count followed by the value. gives up as soon as that gets bigger than raw and stores raw
+    template<class T>
+    static auto encode(T const * const src, size_t const n, std::vector<std::byte> & out) -> bool
+    {
+        size_t const start = out.size();
+        auto const put = [&out](void const * const p, size_t const bytes)
+        {
+            out.resize(out.size() + bytes);
+            std::memcpy(out.data() + out.size() - bytes, p, bytes);
+        };
+
+        for(size_t i = 0; i < n;)
+        {
+            size_t j = i + 1;
+            while(j < n && j - i < UINT16_MAX && std::memcmp(&src[j], &src[i], sizeof(T)) == 0) { ++j; }
+            auto const count = static_cast<uint16_t>(j - i);
+            put(&count, sizeof(count));
+            put(&src[i], sizeof(T));
+            i = j;
+
+            if(out.size() - start >= n * sizeof(T))
+            {
+                out.resize(start);
+                put(src, n * sizeof(T));
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template<class T>
+    static auto decode(std::byte const * p, std::byte const * const end, bool const rle, T * const dst, size_t const n) -> std::byte const *
+    {
+        if(!rle)
+        {
+            if(static_cast<size_t>(end - p) < n * sizeof(T)) { throw std::runtime_error("checkpoint is corrupt!"); }
+            std::memcpy(dst, p, n * sizeof(T));
+            return p + n * sizeof(T);
+        }
+
+        for(size_t i = 0; i < n;)
+        {
+            uint16_t count;
+            T value;
+            if(static_cast<size_t>(end - p) < sizeof(count) + sizeof(T)) { throw std::runtime_error("checkpoint is corrupt!"); }
+            std::memcpy(&count, p, sizeof(count));
+            std::memcpy(&value, p + sizeof(count), sizeof(T));
+            if(count == 0 || count > n - i) { throw std::runtime_error("checkpoint is corrupt!"); }
+            std::fill_n(dst + i, count, value);
+            p += sizeof(count) + sizeof(T);
+            i += count;
+        }
+        return p;
+    }
+};
+
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "grid.hpp"
+#include "util/triple_buffer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <span>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+namespace vkopter::game::citygen
+{
+
+//the cells that changed in a grid, as runs of packed cells in row major order
+template<class Cell = GridCell>
+struct GridDelta
+{
+    struct Run
+    {
+        int32_t x, y, z, w;
+        size_t first; //index of the first cell of the run in cells
+    };
+
+    std::vector<Run> runs;
+    std::vector<Cell> cells;
+
+    [[nodiscard]] auto empty() const -> bool { return runs.empty(); }
+
+    auto clear() -> void
+    {
+        runs.clear();
+        cells.clear();
+    }
+};
+
+//runs an updater on its own thread at a fixed rate of events per second and hands what changed to one consumer,
+//usually the render thread, through a TripleBuffer of GridDeltas. the consumer never waits for the updater and
+//the updater never waits for the consumer.
+//between start() and stop() the grid and the updater belong to the worker thread, nothing else may touch them
+template<class Updater>
+class CityWorker
+{
+public:
+    using GridType = typename Updater::GridType;
+    using Cell = typename GridType::cell_type;
+    using Delta = GridDelta<Cell>;
+
+    //ticks the worker wakes up at, every tick runs the events that came due and publishes what changed
+    static constexpr std::chrono::microseconds TICK{2000};
+
+    //the first delta is the whole grid, so a consumer can start from nothing
+    CityWorker(GridType& grid, Updater& updater, uint64_t const eventsPerSecond, uint32_t const threads = 1) :
+        grid_(grid),
+        updater_(updater),
+        rate_(eventsPerSecond),
+        threads_(threads)
+    {
+        grid_.markAllDirty();
+    }
+
+    CityWorker(CityWorker const &) = delete;
+    auto operator=(CityWorker const &) -> CityWorker& = delete;
+
+    ~CityWorker()
+    {
+        stop();
+    }
+
+    auto start() -> void
+    {
+        if(worker_.joinable()) { return; }
+        worker_ = std::jthread([this](std::stop_token const st) { run(st); });
+    }
+
+    //the grid and the updater are the callers again afterwards, what changed since the last delta is still
+    //handed over through latest()
+    auto stop() -> void
+    {
+        if(!worker_.joinable()) { return; }
+        worker_.request_stop();
+        worker_.join();
+    }
+
+    //0 pauses generation
+    auto setRate(uint64_t const eventsPerSecond) -> void
+    {
+        rate_.store(eventsPerSecond, std::memory_order_relaxed);
+    }
+
+    //the next delta is the whole grid again, e.g. after the renderer lost its copy
+    auto resync() -> void
+    {
+        resync_.store(true, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] auto events() const -> uint64_t
+    {
+        return events_.load(std::memory_order_relaxed);
+    }
+
+    //consumer side: the newest delta or nullptr when nothing changed, valid until the next call
+    auto latest() -> Delta const *
+    {
+        //without a worker running the rest goes out from here
+        if(!worker_.joinable()) { handOver(); }
+        return buffer_.update() ? &buffer_.front() : nullptr;
+    }
+
+private:
+    GridType& grid_;
+    Updater& updater_;
+    std::atomic<uint64_t> rate_;
+    uint32_t threads_;
+    std::atomic<bool> resync_ = false;
+    std::atomic<uint64_t> events_ = 0;
+    TripleBuffer<Delta> buffer_;
+    std::jthread worker_;
+
+    auto run(std::stop_token const st) -> void
+    {
+        using namespace std::chrono;
+
+        auto last = steady_clock::now();
+        double owed = 0.0;
+        while(!st.stop_requested())
+        {
+            auto const now = steady_clock::now();
+            double const rate = static_cast<double>(rate_.load(std::memory_order_relaxed));
+
+            //a worker that could not keep up drops what it owes beyond a tenth of a second instead of spiralling
+            owed = std::min(owed + rate * duration<double>(now - last).count(), rate * 0.1);
+            last = now;
+
+            auto const due = static_cast<uint64_t>(owed);
+            if(due > 0)
+            {
+                updater_.updateParallel(due, threads_);
+                owed -= static_cast<double>(due);
+                events_.fetch_add(due, std::memory_order_relaxed);
+            }
+
+            handOver();
+            std::this_thread::sleep_until(now + TICK);
+        }
+    }
+
+    //packs what changed into the back delta and tries to publish it. a delta the consumer has not made room for
+    //yet waits as it is and later changes stay in the dirty rows of the grid, so no cell is ever in a delta twice
+    //and a consumer that falls behind gets the rows that changed since, not every version of them
+    auto handOver() -> void
+    {
+        Delta& d = buffer_.back();
+        if(d.empty())
+        {
+            if(resync_.exchange(false, std::memory_order_relaxed)) { grid_.markAllDirty(); }
+
+            grid_.consumeDirty([&](int32_t const x, int32_t const y, int32_t const z, int32_t const runWidth)
+            {
+                int32_t const w = std::min(x + runWidth, grid_.width()) - x;
+                d.runs.push_back({x, y, z, w, d.cells.size()});
+                d.cells.resize(d.cells.size() + w);
+                grid_.copyRegion(x, y, z, w, 1, std::span(d.cells).last(w));
+            });
+        }
+
+        if(!d.empty() && buffer_.tryPublish())
+        {
+            buffer_.back().clear();
+        }
+    }
+};
+
+}
@@ -1,48 +1,240 @@
 #pragma once
 
 #include "atom.hpp"
+#include "typeset.hpp"
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
 #include <iostream>
+#include <new>
+#include <span>
+#include <vector>
 
 namespace vkopter::game::citygen
 {
 
-template<int32_t S>
+//a view of the (2S+1)^3 cells around a site, addressed in place in the grid it was made from.
+//cells are only looked at when a rule touches them: the first access remembers the old value and hands out
+//a working copy, Grid::pasteEW writes back the touched cells whose value actually changed.
+//PLANAR windows are for grids with depth 1 and never address or loop over z.
+//the grid holds packed cells in chunks, touched cells are unpacked into full Atoms and packed again on paste.
+//cells in the chunk of the site are addressed straight from the site pointer, the few windows that reach
+//into a neighbouring chunk look those cells up through the grid.
+template<int32_t S, bool PLANAR, class Grid>
 class EventWindow
 {
 public:
+    using Cell = typename Grid::cell_type;
+
     static const int32_t SIZE = S;
+    static constexpr int32_t DIM = (S*2)+1;
+    static constexpr int32_t VOLUME = PLANAR ? DIM*DIM : DIM*DIM*DIM;
+    static constexpr int32_t ROWS = VOLUME / DIM;
+    //largest radius countAround() takes, the parallel updater sizes its tiles so no other tile writes that far
+    static constexpr int32_t MAX_AROUND = 3 * S;
+
+    static_assert(DIM <= 64, "contains() keeps a row of the window in 64 bits");
+
+    struct Touched
+    {
+        int32_t key;
+        bool inside; //false when outside of the grid, writes to those are dropped
+        Cell* cell;  //nullptr when the chunk is not allocated yet, pasting allocates it
+        Atom old;
+        Atom cur;
+    };
+
+    //x,y,z is the site, site points at its cell or is nullptr when its chunk is not allocated.
+    //interior windows lie completely inside the chunk of the site
+    EventWindow(Grid* const grid, int32_t const x, int32_t const y, int32_t const z, Cell* const site, bool const interior) :
+        grid_(grid),
+        x_(x),
+        y_(y),
+        z_(z),
+        site_(site),
+        interior_(interior)
+    {
+    }
+
+    EventWindow(EventWindow const &) = delete;
+    auto operator=(EventWindow const &) -> EventWindow& = delete;
 
     auto operator () (const int32_t x, const int32_t y, const int32_t z = 0) -> Atom&
     {
-        //fix adressing for negative x,y,z
-        constexpr auto DIM = (S*2)+1;
-        int32_t const x2 = x+S;
-        int32_t const y2 = y+S;
-        int32_t const z2 = z+S;
-        auto g = x2 + y2 * DIM + z2 * DIM * DIM;
-        return atoms_[x2 + y2 * DIM + z2 * DIM * DIM];
+        if(PLANAR && z != 0)
+        {
+            sink_ = Empty;
+            return sink_;
+        }
+
+        int32_t const k = key(x,y,z);
+        Touched* const log = entries();
+        for(uint32_t i = 0; i < num_touched_; ++i)
+        {
+            if(log[i].key == k)
+            {
+                return log[i].cur;
+            }
+        }
+
+        bool const in = inside(x,y,z);
+        Cell* const c = in ? cell(x,y,z) : nullptr;
+        Atom const old = c ? c->unpack() : Atom{};
+        auto* t = new (&log[num_touched_++]) Touched{k, in, c, old, old};
+        return t->cur;
     }
 
-    [[nodiscard]] auto contains(const std::vector<Type>& l) const -> bool
+    //true when any cell of the window holds one of the types, touched cells count with their current value.
+    //interior windows test whole rows of packed cells against the set at once, see TypeSet::match
+    [[nodiscard]] auto contains(TypeSet const set) const -> bool
     {
-        for(auto& a : atoms_)
+        //touched cells hold the current value, the grid only the old one, so their grid cells are masked out
+        std::array<uint64_t, ROWS> touchedRows{};
+        for(auto const & t : touched())
         {
-            for(auto& lt : l)
+            if(set.contains(t.cur.type))
             {
-                if (a.type == lt)
+                return true;
+            }
+            touchedRows[t.key / DIM] |= uint64_t{1} << (t.key % DIM);
+        }
+
+        if constexpr (BYTE_CELLS)
+        {
+            if(interior_)
+            {
+                auto const * const first = reinterpret_cast<uint8_t const *>(site_ - S);
+                for(int32_t y = -S; y <= S; ++y)
                 {
-                    return true;
+                    if(set.match(first + y * Grid::CHUNK_SIZE, DIM) & ~touchedRows[y + S])
+                    {
+                        return true;
+                    }
+                }
+                return false;
+            }
+        }
+
+        int32_t const z0 = PLANAR ? 0 : std::max(-S, -z_);
+        int32_t const z1 = PLANAR ? 0 : std::min(S, grid_->depth() - 1 - z_);
+        int32_t const y0 = std::max(-S, -y_);
+        int32_t const y1 = std::min(S, grid_->height() - 1 - y_);
+        int32_t const x0 = std::max(-S, -x_);
+        int32_t const x1 = std::min(S, grid_->width() - 1 - x_);
+        for(int32_t z = z0; z <= z1; ++z)
+        {
+            for(int32_t y = y0; y <= y1; ++y)
+            {
+                //a row is one or two runs of cells in different chunks
+                uint64_t const skip = touchedRows[key(0,y,z) / DIM];
+                for(int32_t x = x0; x <= x1;)
+                {
+                    int32_t const gx = x_ + x;
+                    int32_t const n = std::min(x1 - x + 1, Grid::CHUNK_SIZE - (gx & Grid::CHUNK_MASK));
+                    Cell const * const run = grid_->find(gx, y_ + y, PLANAR ? z_ : z_ + z);
+                    for(int32_t i = 0; i < n; ++i)
+                    {
+                        if(set.contains(run ? run[i].type() : Empty) && !((skip >> (x + i + S)) & 1))
+                        {
+                            return true;
+                        }
+                    }
+                    x += n;
                 }
             }
         }
         return false;
     }
 
+    [[nodiscard]] auto contains(const std::vector<Type>& l) const -> bool
+    {
+        return contains(TypeSet(l));
+    }
+
+    //cells of the types in set in the square of radius r around the site, r can go up to MAX_AROUND. reads the
+    //grid as it was before this event, cells touched by it count with their old value. cheap on grids that keep
+    //occupancy counts (Grid::enableOccupancy()), a scan of the square on all others
+    [[nodiscard]] auto countAround(TypeSet const set, int32_t const r) const -> uint64_t
+    {
+        assert(r <= MAX_AROUND);
+        return grid_->count(set, x_ - r, y_ - r, 2 * r + 1, 2 * r + 1, z_);
+    }
+
+    [[nodiscard]] auto touched() const -> std::span<Touched const>
+    {
+        return {entries(), num_touched_};
+    }
+
+    //grid coordinates of a touched cell
+    [[nodiscard]] auto positionOf(Touched const & t) const -> std::array<int32_t, 3>
+    {
+        int32_t const dx = t.key % DIM - S;
+        int32_t const dy = (t.key / DIM) % DIM - S;
+        int32_t const dz = PLANAR ? 0 : t.key / (DIM * DIM) - S;
+        return {x_ + dx, y_ + dy, z_ + dz};
+    }
+
+    [[nodiscard]] auto isInterior() const -> bool
+    {
+        return interior_;
+    }
 
 
 private:
-    std::array<Atom, ((SIZE*2)+1)*((SIZE*2)+1)*((SIZE*2)+1)> atoms_;
+    //cells the TypeSet byte kernels can read straight from the chunk
+    static constexpr bool BYTE_CELLS = PLANAR && sizeof(Cell) == 1 && Cell::TYPE_WIDTH == 4;
+
+    Grid* grid_;
+    int32_t x_;
+    int32_t y_;
+    int32_t z_;
+    Cell* site_;
+    bool interior_;
+    Atom sink_;
+
+    //raw storage so that making a window does not construct VOLUME entries, they are created on first touch
+    uint32_t num_touched_ = 0;
+    alignas(Touched) std::byte touched_[sizeof(Touched) * VOLUME];
+
+    auto entries() -> Touched*
+    {
+        return std::launder(reinterpret_cast<Touched*>(touched_));
+    }
+
+    auto entries() const -> Touched const *
+    {
+        return std::launder(reinterpret_cast<Touched const *>(touched_));
+    }
+
+    static constexpr auto key(const int32_t x, const int32_t y, const int32_t z) -> int32_t
+    {
+        //fix adressing for negative x,y,z
+        if constexpr (PLANAR)
+        {
+            return (x+S) + (y+S) * DIM;
+        }
+        return (x+S) + (y+S) * DIM + (z+S) * DIM * DIM;
+    }
+
+    [[nodiscard]] auto inside(const int32_t x, const int32_t y, const int32_t z) const -> bool
+    {
+        return interior_ || grid_->isInBounds(x_ + x, y_ + y, PLANAR ? z_ : z_ + z);
+    }
+
+    //x,y,z has to be inside the grid. chunks are one z layer, so only z == 0 can share the chunk of the site
+    auto cell(const int32_t x, const int32_t y, const int32_t z) const -> Cell*
+    {
+        constexpr int32_t M = ~Grid::CHUNK_MASK;
+        bool const near = interior_ ||
+                          (site_ && ((x_ + x) & M) == (x_ & M) && ((y_ + y) & M) == (y_ & M) && (PLANAR || z == 0));
+        if(near)
+        {
+            return site_ + x + y * Grid::CHUNK_SIZE;
+        }
+        return grid_->find(x_ + x, y_ + y, z_ + (PLANAR ? 0 : z));
+    }
 
 };
 
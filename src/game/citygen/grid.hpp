@@ -2,18 +2,48 @@
 
 #include "atom.hpp"
 #include "eventwindow.hpp"
-#include "../terrain.hpp"
+#include "typeset.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <memory>
+#include <span>
+#include <vector>
 
 namespace vkopter::game::citygen
 {
 
-template<int32_t W, int32_t H, int32_t D>
+//cells are stored packed (see PackedAtom) in CHUNK_SIZE x CHUNK_SIZE chunks on the heap, one z layer each.
+//a chunk only exists once something other than Empty has been written into it, so memory grows with the
+//populated area of the city and not with its size. the per site memory lives next to the cells as
+//optional struct of arrays layers, per chunk as well.
+//writing through operator() allocates, reading through get() or the const operator() never does.
+//chunks are allocated lock free, so tiles of the parallel scheduler can paste into the same fresh chunk.
+//every chunk has a dirty mask with one bit per row, set by writes and collected by consumeDirty() so
+//the renderer only uploads the rows that changed since the last frame.
+//optionally the grid keeps a pyramid of per type counts, see enableOccupancy()
+template<class Cell = GridCell>
 class Grid
 {
 public:
-    static constexpr decltype(W) WIDTH = W;
-    static constexpr decltype(H) HEIGHT = H;
-    static constexpr decltype(D) DEPTH = D;
+    static constexpr int32_t CHUNK_BITS = 6;
+    static constexpr int32_t CHUNK_SIZE = 1 << CHUNK_BITS;
+    static constexpr int32_t CHUNK_MASK = CHUNK_SIZE - 1;
+    static constexpr int32_t CHUNK_CELLS = CHUNK_SIZE * CHUNK_SIZE;
+    static constexpr int32_t CHUNK_PADDING = 16; //so the TypeSet kernels can read 16 cells from anywhere in a chunk
+
+    //occupancy counts are kept per BLOCK_SIZE x BLOCK_SIZE block, per chunk, and from there on per block of
+    //BLOCK_SIZE x BLOCK_SIZE blocks of the level below until one block covers the grid
+    static constexpr int32_t BLOCK_BITS = 3;
+    static constexpr int32_t BLOCK_SIZE = 1 << BLOCK_BITS;
+
+    using cell_type = Cell;
+
+    template<int32_t S, bool PLANAR>
+    using Window = EventWindow<S, PLANAR, Grid>;
 
     enum SiteLayer : uint8_t
     {
@@ -21,128 +51,775 @@ public:
         Altitude,
         Crime,
         Economy,
-        Pollution
+        Pollution,
+
+        NUM_SITE_LAYERS
+    };
+
+    Grid(int32_t const width, int32_t const height, int32_t const depth = 1) :
+        width_(width),
+        height_(height),
+        depth_(depth),
+        chunks_x_((width + CHUNK_MASK) >> CHUNK_BITS),
+        chunks_y_((height + CHUNK_MASK) >> CHUNK_BITS),
+        chunks_(static_cast<size_t>(chunks_x_) * chunks_y_ * depth),
+        dirty_(chunks_.size())
+    {
+        assert(width > 0 && height > 0 && depth > 0);
+        assert(static_cast<uint64_t>(width) * height * depth <= UINT32_MAX);
+    }
+
+    Grid(Grid const &) = delete;
+    auto operator=(Grid const &) -> Grid& = delete;
+
+    ~Grid()
+    {
+        release();
+    }
+
+    [[nodiscard]] auto width() const -> int32_t { return width_; }
+    [[nodiscard]] auto height() const -> int32_t { return height_; }
+    [[nodiscard]] auto depth() const -> int32_t { return depth_; }
+    [[nodiscard]] auto size() const -> uint64_t { return static_cast<uint64_t>(width_) * height_ * depth_; }
+
+    //what the non-const operator() hands out. it reads like the cell, and writes go through set(), so they keep
+    //the occupancy counts like every other write
+    class CellRef
+    {
+    public:
+        CellRef(Grid& grid, const int32_t x, const int32_t y, const int32_t z) :
+            grid_(grid), x_(x), y_(y), z_(z)
+        {}
+
+        operator Cell () const { return grid_.get(x_,y_,z_); }
+
+        [[nodiscard]] auto type() const -> Type { return grid_.get(x_,y_,z_).type(); }
+        [[nodiscard]] auto data() const -> uint32_t { return grid_.get(x_,y_,z_).data(); }
+        [[nodiscard]] auto unpack() const -> Atom { return grid_.get(x_,y_,z_).unpack(); }
 
+        auto operator = (Atom const & a) -> CellRef&
+        {
+            grid_.set(x_,y_,z_,a);
+            return *this;
+        }
+
+        auto operator = (Cell const & c) -> CellRef&
+        {
+            return (*this) = c.unpack();
+        }
+
+        //like a Cell, only the type changes and the data stays
+        auto operator = (Type const t) -> CellRef&
+        {
+            Cell c = grid_.get(x_,y_,z_);
+            c = t;
+            return (*this) = c;
+        }
+
+    private:
+        Grid& grid_;
+        int32_t x_, y_, z_;
     };
 
-    auto operator()(const int32_t x, const int32_t y, const int32_t z = 0) -> Atom&
+    //writes allocate the chunk of x,y,z and mark the cell dirty, so only use it to write
+    auto operator()(const int32_t x, const int32_t y, const int32_t z = 0) -> CellRef
+    {
+        return CellRef(*this, x, y, z);
+    }
+
+    auto operator()(const int32_t x, const int32_t y, const int32_t z = 0) const -> Cell const &
+    {
+        static Cell const empty;
+        Chunk const * const c = chunks_[chunkIndex(x,y,z)].load(std::memory_order_acquire);
+        return c ? c->cells[local(x,y)] : empty;
+    }
+
+    [[nodiscard]] auto get(const int32_t x, const int32_t y, const int32_t z = 0) const -> Cell
+    {
+        return (*this)(x,y,z);
+    }
+
+    //writes one cell, allocates its chunk, marks it dirty and keeps the occupancy counts
+    auto set(const int32_t x, const int32_t y, const int32_t z, Atom const & a) -> void
     {
-        return atoms_[x + y * W + z * W * H];
+        Cell& c = cell(x,y,z);
+        Type const old = c.type();
+        c = a;
+        if(occupancy_) { retype(x, y, z, old, a.type); }
     }
 
-    template<int32_t S>
-    auto copyEW(int32_t const x, int32_t const y, int32_t const z = 0) -> EventWindow<S>
+    //the cell if its chunk is allocated, nullptr otherwise
+    auto find(const int32_t x, const int32_t y, const int32_t z = 0) -> Cell*
     {
-        EventWindow<S> win, win2, win3;
+        Chunk* const c = chunks_[chunkIndex(x,y,z)].load(std::memory_order_acquire);
+        return c ? &c->cells[local(x,y)] : nullptr;
+    }
 
-        for(int32_t ewx = -EventWindow<S>::SIZE; ewx <= EventWindow<S>::SIZE; ++ewx)
+    [[nodiscard]] auto hasChunk(const int32_t x, const int32_t y, const int32_t z = 0) const -> bool
+    {
+        return chunks_[chunkIndex(x,y,z)].load(std::memory_order_acquire) != nullptr;
+    }
+
+    //event windows are views into the chunks, nothing is copied until a rule touches a cell.
+    //planar sites at least S away from every edge of their chunk take the interior path without any bounds checks
+    template<int32_t S, bool PLANAR>
+    auto viewEW(int32_t const x, int32_t const y, int32_t const z = 0) -> Window<S, PLANAR>
+    {
+        int32_t const lx = x & CHUNK_MASK;
+        int32_t const ly = y & CHUNK_MASK;
+        Cell* const site = find(x,y,z);
+        bool const interior = PLANAR && site &&
+                              lx >= S && lx + S < CHUNK_SIZE && x + S < width_ &&
+                              ly >= S && ly + S < CHUNK_SIZE && y + S < height_;
+        return Window<S, PLANAR>(this, x, y, z, site, interior);
+    }
+
+    template<int32_t S, bool PLANAR>
+    auto pasteEW(Window<S, PLANAR> const & ew) -> void
+    {
+        for(auto const & t : ew.touched())
         {
-            for(int32_t ewy = -EventWindow<S>::SIZE; ewy <= EventWindow<S>::SIZE; ++ewy)
+            if(t.inside && (t.cur.type != t.old.type || t.cur.data != t.old.data))
             {
-                for(int32_t ewz = -EventWindow<S>::SIZE; ewz <= EventWindow<S>::SIZE; ++ewz)
+                auto const p = ew.positionOf(t);
+                if(t.cell)
                 {
-                    if(isInBounds(ewx+x, ewy+y,ewz+z))
-                    {
-                        win(ewx,ewy,ewz) = (*this)(ewx+x, ewy+y,ewz+z);
-                        //win.siteMemory(0,ewx,ewy,ewz) = siteMemory(0,ewx+x, ewy+y,ewz+z);
-                        //win.siteMemory(1,ewx,ewy,ewz) = siteMemory(1,ewx+x, ewy+y,ewz+z);
+                    *t.cell = t.cur;
+                    markDirty(p[0], p[1], p[2]);
+                }
+                else
+                {
+                    cell(p[0], p[1], p[2]) = t.cur;
+                }
+                if(occupancy_) { retype(p[0], p[1], p[2], t.old.type, t.cur.type); }
+            }
+        }
+    }
 
-                    }
-                    else
-                    {
-                        win(ewx,ewy,ewz) = Empty;
-                        //win.siteMemory(0,ewx,ewy,ewz) = 0;
-                        //win.siteMemory(1,ewx,ewy,ewz) = 0;
+    auto isInBounds(const int32_t x, const int32_t y, const int32_t z = 0) const -> bool
+    {
+        return x <= width_ - 1 &&
+                x >= 0 &&
+                y <= height_ - 1 &&
+                y >= 0 &&
+                z <= depth_ - 1 &&
+                z >= 0;
+    }
+
+    //clearing to Empty gives all chunks back
+    auto clear(const Type& t = Empty) -> void
+    {
+        release();
+        markAllDirty();
+        if(t == Empty)
+        {
+            if(occupancy_) { enableOccupancy(); }
+            return;
+        }
+
+        for(int32_t z = 0; z < depth_; ++z)
+        {
+            for(int32_t y = 0; y < height_; y += CHUNK_SIZE)
+            {
+                for(int32_t x = 0; x < width_; x += CHUNK_SIZE)
+                {
+                    Chunk* const c = chunk(x,y,z);
+                    std::fill(c->cells.get(), c->cells.get() + CHUNK_CELLS, Cell(Atom{t,0}));
+                }
+            }
+        }
+        if(occupancy_) { enableOccupancy(); }
+    }
 
+    //frees chunks that went back to all Empty and hold no site memory, not safe while updaters run
+    auto shrink() -> void
+    {
+        for(auto& a : chunks_)
+        {
+            Chunk* const c = a.load(std::memory_order_relaxed);
+            if(!c) { continue; }
+
+            bool const empty = std::all_of(c->cells.get(), c->cells.get() + CHUNK_CELLS, [](Cell const & cell) { return !cell; });
+            bool const noLayers = std::all_of(c->layers.begin(), c->layers.end(), [](auto const & l) { return !l; });
+            if(empty && noLayers)
+            {
+                a.store(nullptr, std::memory_order_relaxed);
+                delete c;
+            }
+        }
+    }
+
+    [[nodiscard]] auto allocatedChunks() const -> size_t
+    {
+        return std::count_if(chunks_.begin(), chunks_.end(), [](auto const & a) { return a.load(std::memory_order_relaxed) != nullptr; });
+    }
+
+    //heap used by cells and site memory, not counting the chunk table
+    [[nodiscard]] auto memoryBytes() const -> size_t
+    {
+        size_t bytes = 0;
+        for(auto const & a : chunks_)
+        {
+            Chunk const * const c = a.load(std::memory_order_relaxed);
+            if(!c) { continue; }
+            bytes += sizeof(Chunk) + sizeof(Cell) * (CHUNK_CELLS + CHUNK_PADDING);
+            for(auto const & l : c->layers)
+            {
+                bytes += l ? CHUNK_CELLS : 0;
+            }
+            bytes += c->occupancy ? sizeof(Occupancy) : 0;
+        }
+        for(auto const & l : levels_)
+        {
+            bytes += l.size() * sizeof(uint32_t);
+        }
+        return bytes;
+    }
+
+    //copies the w x h cells at x,y,z row by row into out, cells outside of the grid or in missing chunks are Empty
+    auto copyRegion(int32_t const x, int32_t const y, int32_t const z, int32_t const w, int32_t const h,
+                    std::span<Cell> const out) const -> void
+    {
+        assert(out.size() >= static_cast<size_t>(w) * h);
+        for(int32_t ry = 0; ry < h; ++ry)
+        {
+            Cell* const row = out.data() + static_cast<size_t>(ry) * w;
+            int32_t const gy = y + ry;
+            if(gy < 0 || gy >= height_ || z < 0 || z >= depth_)
+            {
+                std::fill_n(row, w, Cell{});
+                continue;
+            }
+
+            //whole pieces of chunk rows at a time
+            for(int32_t rx = 0; rx < w;)
+            {
+                int32_t const gx = x + rx;
+                if(gx < 0 || gx >= width_)
+                {
+                    row[rx++] = Cell{};
+                    continue;
+                }
+
+                int32_t const n = std::min({w - rx, CHUNK_SIZE - (gx & CHUNK_MASK), width_ - gx});
+                Chunk const * const c = chunks_[chunkIndex(gx,gy,z)].load(std::memory_order_acquire);
+                if(c)
+                {
+                    std::copy_n(c->cells.get() + local(gx,gy), n, row + rx);
+                }
+                else
+                {
+                    std::fill_n(row + rx, n, Cell{});
+                }
+                rx += n;
+            }
+        }
+    }
+
+    //calls f(x, y, z, w) for every run of w cells starting at x,y,z that changed since the last call and
+    //forgets them. runs are in row major order and runs of neighbouring chunks are merged, so they map to
+    //as few copies as possible. runs may reach past the width of the grid up to the end of the last chunk.
+    //not while updaters run, the cells of the runs are read right after
+    template<class F>
+    auto consumeDirty(F&& f) -> void
+    {
+        std::vector<uint64_t> rows(chunks_x_);
+        for(int32_t cz = 0; cz < depth_; ++cz)
+        {
+            for(int32_t cy = 0; cy < chunks_y_; ++cy)
+            {
+                size_t const first = (static_cast<size_t>(cz) * chunks_y_ + cy) * chunks_x_;
+                uint64_t any = 0;
+                for(int32_t cx = 0; cx < chunks_x_; ++cx)
+                {
+                    auto& d = dirty_[first + cx];
+                    rows[cx] = d.load(std::memory_order_relaxed) ? d.exchange(0, std::memory_order_relaxed) : 0;
+                    any |= rows[cx];
+                }
+
+                while(any)
+                {
+                    int32_t const ly = std::countr_zero(any);
+                    any &= any - 1;
+                    uint64_t const bit = uint64_t(1) << ly;
+                    for(int32_t cx = 0; cx < chunks_x_; ++cx)
+                    {
+                        if(!(rows[cx] & bit)) { continue; }
+                        int32_t const begin = cx;
+                        while(cx + 1 < chunks_x_ && (rows[cx + 1] & bit)) { ++cx; }
+                        f(begin << CHUNK_BITS, (cy << CHUNK_BITS) + ly, cz, (cx - begin + 1) << CHUNK_BITS);
                     }
                 }
             }
         }
+    }
+
+    //everything has to be uploaded again, e.g. after the renderer lost its copy
+    auto markAllDirty() -> void
+    {
+        for(auto& d : dirty_)
+        {
+            d.store(~uint64_t(0), std::memory_order_relaxed);
+        }
+    }
+
+    //layers take no space until a site writes to them, and then only in that sites chunk
+    auto enableLayer(SiteLayer const l) -> void
+    {
+        layers_enabled_[l] = true;
+    }
+
+    auto disableLayer(SiteLayer const l) -> void
+    {
+        layers_enabled_[l] = false;
+        for(auto& a : chunks_)
+        {
+            if(Chunk* const c = a.load(std::memory_order_relaxed)) { c->layers[l].reset(); }
+        }
+    }
+
+    [[nodiscard]] auto hasLayer(SiteLayer const l) const -> bool
+    {
+        return layers_enabled_[l];
+    }
+
+    //allocates the chunk and its layer
+    auto siteMemory(SiteLayer const l, int32_t const x, int32_t const y, int32_t const z = 0) -> uint8_t&
+    {
+        assert(hasLayer(l));
+        auto& layer = chunk(x,y,z)->layers[l];
+        if(!layer)
+        {
+            layer = std::make_unique<uint8_t[]>(CHUNK_CELLS);
+        }
+        return layer[local(x,y)];
+    }
+
+    [[nodiscard]] auto siteMemory(SiteLayer const l, int32_t const x, int32_t const y, int32_t const z = 0) const -> uint8_t
+    {
+        Chunk const * const c = chunks_[chunkIndex(x,y,z)].load(std::memory_order_acquire);
+        return c && c->layers[l] ? c->layers[l][local(x,y)] : 0;
+    }
+
+    //whole chunks at once, for saving and loading. x,y,z is any cell of the chunk, chunks are CHUNK_CELLS cells
+    //in row major order. the const ones give nullptr for chunks or layers that do not exist
+    [[nodiscard]] auto chunkCells(const int32_t x, const int32_t y, const int32_t z = 0) const -> Cell const *
+    {
+        Chunk const * const c = chunks_[chunkIndex(x,y,z)].load(std::memory_order_acquire);
+        return c ? c->cells.get() : nullptr;
+    }
+
+    [[nodiscard]] auto chunkLayer(SiteLayer const l, const int32_t x, const int32_t y, const int32_t z = 0) const -> uint8_t const *
+    {
+        Chunk const * const c = chunks_[chunkIndex(x,y,z)].load(std::memory_order_acquire);
+        return c ? c->layers[l].get() : nullptr;
+    }
+
+    //allocates the chunk and marks all of its rows dirty, the caller writes all of its cells and then calls
+    //recountChunk() if the grid keeps occupancy counts
+    auto writeChunk(const int32_t x, const int32_t y, const int32_t z = 0) -> Cell*
+    {
+        dirty_[chunkIndex(x,y,z)].store(~uint64_t(0), std::memory_order_relaxed);
+        return chunk(x,y,z)->cells.get();
+    }
+
+    auto writeChunkLayer(SiteLayer const l, const int32_t x, const int32_t y, const int32_t z = 0) -> uint8_t*
+    {
+        return &siteMemory(l, x & ~CHUNK_MASK, y & ~CHUNK_MASK, z);
+    }
+
+    //gives the chunk back, its cells are Empty again. not safe while updaters run
+    auto releaseChunk(const int32_t x, const int32_t y, const int32_t z = 0) -> void
+    {
+        size_t const i = chunkIndex(x,y,z);
+        if(Chunk* const c = chunks_[i].exchange(nullptr, std::memory_order_relaxed))
+        {
+            if(c->occupancy) { addToLevels(x, y, z, *c->occupancy, -1); }
+            delete c;
+            dirty_[i].store(~uint64_t(0), std::memory_order_relaxed);
+        }
+    }
+
+    //counts the cells of a chunk written through writeChunk() again, not safe while updaters run
+    auto recountChunk(const int32_t x, const int32_t y, const int32_t z = 0) -> void
+    {
+        Chunk* const c = chunks_[chunkIndex(x,y,z)].load(std::memory_order_relaxed);
+        if(!occupancy_ || !c) { return; }
 
-        return win;
+        addToLevels(x, y, z, *c->occupancy, -1);
+        countChunk(x, y, *c);
+        addToLevels(x, y, z, *c->occupancy, 1);
     }
 
-    template<int32_t S>
-    auto pasteEW(EventWindow<S>& ew, int32_t const x, int32_t const y, int32_t const z = 0) -> void
+    //starts keeping per type counts over a pyramid of blocks: 8x8 blocks and whole chunks, which live in the
+    //chunks and cost nothing where the grid is Empty, and blocks of 8x8 of the level below from there on.
+    //count() then adds up a few block counts instead of reading every cell. pasteEW, set(), operator(), clear()
+    //and the whole chunk functions keep the counts
+    auto enableOccupancy() -> void
     {
-        for(int32_t ewx = -EventWindow<S>::SIZE; ewx < EventWindow<S>::SIZE; ++ewx)
+        occupancy_ = true;
+        levels_.clear();
+        for(int64_t size = static_cast<int64_t>(CHUNK_SIZE) * BLOCK_SIZE; size < BLOCK_SIZE * static_cast<int64_t>(std::max(width_, height_)); size *= BLOCK_SIZE)
         {
-            for(int32_t ewy = -EventWindow<S>::SIZE; ewy < EventWindow<S>::SIZE; ++ewy)
+            levels_.emplace_back(static_cast<size_t>((width_ + size - 1) / size) * ((height_ + size - 1) / size) * depth_ * COUNTED);
+        }
+
+        for(int32_t z = 0; z < depth_; ++z)
+        {
+            for(int32_t y = 0; y < height_; y += CHUNK_SIZE)
             {
-                for(int32_t ewz = -EventWindow<S>::SIZE; ewz < EventWindow<S>::SIZE; ++ewz)
+                for(int32_t x = 0; x < width_; x += CHUNK_SIZE)
                 {
-                    if(isInBounds(x + ewx,y + ewy,z + ewz))
+                    if(Chunk* const c = chunks_[chunkIndex(x,y,z)].load(std::memory_order_relaxed))
                     {
-                        (*this)( x + ewx, y + ewy, z + ewz) =  ew(ewx,ewy,ewz);
-                        // siteMemory(0, x + ewx, y + ewy, z + ewz) =  ew.siteMemory(0,ewx,ewy,ewz);
-                        // siteMemory(1, x + ewx, y + ewy, z + ewz) =  ew.siteMemory(1,ewx,ewy,ewz);
-                        // siteMemory(2, x + ewx, y + ewy, z + ewz) =  ew.siteMemory(2,ewx,ewy,ewz);
-                        // siteMemory(3, x + ewx, y + ewy, z + ewz) =  ew.siteMemory(3,ewx,ewy,ewz);
-                        // siteMemory(4, x + ewx, y + ewy, z + ewz) =  ew.siteMemory(4,ewx,ewy,ewz);
-                        // siteMemory(5, x + ewx, y + ewy, z + ewz) =  ew.siteMemory(5,ewx,ewy,ewz);
-                        // siteMemory(6, x + ewx, y + ewy, z + ewz) =  ew.siteMemory(6,ewx,ewy,ewz);
-                        // siteMemory(7, x + ewx, y + ewy, z + ewz) =  ew.siteMemory(7,ewx,ewy,ewz);
+                        countChunk(x, y, *c);
+                        addToLevels(x, y, z, *c->occupancy, 1);
                     }
                 }
             }
         }
     }
 
-    auto isInBounds(const int32_t x, const int32_t y, const int32_t z = 0) const -> bool
+    auto disableOccupancy() -> void
     {
-        return x <= W - 1 &&
-                x >= 0 &&
-                y <= H - 1 &&
-                y >= 0 &&
-                z <= D - 1 &&
-                z >= 0;
+        occupancy_ = false;
+        levels_.clear();
+        for(auto& a : chunks_)
+        {
+            if(Chunk* const c = a.load(std::memory_order_relaxed)) { c->occupancy.reset(); }
+        }
     }
 
-    auto clear(const Type& t = Empty) -> void
+    [[nodiscard]] auto hasOccupancy() const -> bool
     {
-        std::fill(atoms_.begin(),atoms_.end(),Atom{t,0});
+        return occupancy_;
     }
 
+    //cells of the types in set in the w x h box at x,y,z, the parts of the box outside of the grid count as
+    //nothing. with occupancy counts every whole block on the way down is one lookup per type, only the cells
+    //along the border of the box are read one by one, without them every cell is
+    [[nodiscard]] auto count(TypeSet const set, int32_t const x, int32_t const y, int32_t const w, int32_t const h,
+                             int32_t const z = 0) const -> uint64_t
+    {
+        int32_t const x0 = std::max(x, 0);
+        int32_t const y0 = std::max(y, 0);
+        int32_t const x1 = static_cast<int32_t>(std::min<int64_t>(static_cast<int64_t>(x) + w, width_));
+        int32_t const y1 = static_cast<int32_t>(std::min<int64_t>(static_cast<int64_t>(y) + h, height_));
+        if(x0 >= x1 || y0 >= y1 || z < 0 || z >= depth_) { return 0; }
 
-    // auto siteMemory(size_t const N, int32_t const x, int32_t const y, int32_t const z = 0) -> int8_t&
-    // {
-    //     return site_memory_[N][x][y][z];
-    // }
+        //Empty is not counted, it is whatever is left
+        TypeSet const counted = set - TypeSet{Empty};
+        uint64_t n = counted.empty() ? 0 : countBox(counted, topLevel(), x0, y0, x1, y1, z);
+        if(set.contains(Empty))
+        {
+            uint64_t const area = static_cast<uint64_t>(x1 - x0) * (y1 - y0);
+            n += area - countBox(TypeSet::all() - TypeSet{Empty}, topLevel(), x0, y0, x1, y1, z);
+        }
+        return n;
+    }
+
+    //whether the box holds any cell of the types in set, stops at the first block that has one
+    [[nodiscard]] auto any(TypeSet const set, int32_t const x, int32_t const y, int32_t const w, int32_t const h,
+                           int32_t const z = 0) const -> bool
+    {
+        if(set.contains(Empty)) { return count(set, x, y, w, h, z) > 0; }
+
+        int32_t const x0 = std::max(x, 0);
+        int32_t const y0 = std::max(y, 0);
+        int32_t const x1 = static_cast<int32_t>(std::min<int64_t>(static_cast<int64_t>(x) + w, width_));
+        int32_t const y1 = static_cast<int32_t>(std::min<int64_t>(static_cast<int64_t>(y) + h, height_));
+        if(x0 >= x1 || y0 >= y1 || z < 0 || z >= depth_ || set.empty()) { return false; }
+        return countBox(set, topLevel(), x0, y0, x1, y1, z, 1) > 0;
+    }
 
+    //a template so that the grid does not drag the terrain (and with it stb_image) into everything that includes it
+    template<class Terrain>
     auto loadTerrain(Terrain & terrain) -> void
     {
-        for(auto x = 0ul; x < W; ++x)
+        enableLayer(TerrainType);
+        enableLayer(Altitude);
+
+        auto const w = std::min<uint32_t>(width_, terrain.getWidth());
+        auto const h = std::min<uint32_t>(height_, terrain.getHeight());
+        for(uint32_t y = 0; y < h; ++y)
         {
-            for(auto y = 0ul; y < H; ++y)
+            for(uint32_t x = 0; x < w; ++x)
             {
-                //site_memory_[SiteLayer::TerrainType][x][y][0] = terrain.termap().at(x,y);
-                //site_memory_[SiteLayer::Altitude][x][y][0] = terrain.altmap().at(x,y);
+                siteMemory(TerrainType, x, y) = terrain.termap().at(x,y);
+                siteMemory(Altitude, x, y) = terrain.altmap().at(x,y);
             }
         }
+    }
+
+private:
+    //Empty is never counted, every other type has a slot at type - 1
+    static constexpr int32_t COUNTED = NUM_TYPES - 1;
+    static constexpr int32_t BLOCKS_PER_CHUNK = (CHUNK_SIZE / BLOCK_SIZE) * (CHUNK_SIZE / BLOCK_SIZE);
+
+    static_assert(CHUNK_SIZE % BLOCK_SIZE == 0 && BLOCK_SIZE * BLOCK_SIZE <= UINT8_MAX + 1 && CHUNK_CELLS <= UINT16_MAX + 1,
+                  "the counts of a block and of a chunk have to fit their counters");
+
+    //the two lowest levels of the pyramid, atomics since tiles of the parallel updater share blocks
+    struct Occupancy
+    {
+        std::array<std::array<std::atomic<uint8_t>, COUNTED>, BLOCKS_PER_CHUNK> blocks{};
+        std::array<std::atomic<uint16_t>, COUNTED> chunk{};
+    };
+
+    struct Chunk
+    {
+        std::unique_ptr<Cell[]> cells = std::make_unique<Cell[]>(CHUNK_CELLS + CHUNK_PADDING);
+        std::array<std::unique_ptr<uint8_t[]>, NUM_SITE_LAYERS> layers;
+        std::unique_ptr<Occupancy> occupancy;
+    };
+
+    int32_t width_;
+    int32_t height_;
+    int32_t depth_;
+    int32_t chunks_x_;
+    int32_t chunks_y_;
+    std::vector<std::atomic<Chunk*>> chunks_;
+    std::vector<std::atomic<uint64_t>> dirty_; //one bit per row of each chunk
+    std::array<bool, NUM_SITE_LAYERS> layers_enabled_{};
+    bool occupancy_ = false;
+    std::vector<std::vector<std::atomic<uint32_t>>> levels_; //the levels above the chunks, blocks of 8^l chunks
 
+    [[nodiscard]] auto chunkIndex(const int32_t x, const int32_t y, const int32_t z) const -> size_t
+    {
+        return (x >> CHUNK_BITS) + (y >> CHUNK_BITS) * static_cast<size_t>(chunks_x_) + z * static_cast<size_t>(chunks_x_) * chunks_y_;
     }
 
-    auto atoms() -> std::array<Atom,W*H*D>&
+    static constexpr auto local(const int32_t x, const int32_t y) -> int32_t
     {
-        return atoms_;
+        return (x & CHUNK_MASK) + ((y & CHUNK_MASK) << CHUNK_BITS);
     }
 
-private:
-    std::array<Atom, W*H*D> atoms_;
-
-    // int ThreeToOne (int x, int y, int z, int xSize, int ySize, int zSize) {
-    //     return x + y * xSize + z * xSize * ySize;
-    // }
-    // void OneToThree (int index, int xSize,int ySize, int zSize)
-    // {
-    //     int resultx, resulty, resultz;
-    //     resultx = index % xSize;
-    //     resulty = (index / xSize) % ySize;
-    //     resultz = index / (xSize * ySize);
-    //     //return result;
-    // }
+    //allocates the chunk of x,y,z and marks the cell dirty, the occupancy counts are up to the caller
+    auto cell(const int32_t x, const int32_t y, const int32_t z) -> Cell&
+    {
+        markDirty(x,y,z);
+        return chunk(x,y,z)->cells[local(x,y)];
+    }
+
+    //the mask is read first so rows that are dirty already do not bounce the cache line between threads
+    auto markDirty(const int32_t x, const int32_t y, const int32_t z) -> void
+    {
+        auto& d = dirty_[chunkIndex(x,y,z)];
+        uint64_t const bit = uint64_t(1) << (y & CHUNK_MASK);
+        if(!(d.load(std::memory_order_relaxed) & bit))
+        {
+            d.fetch_or(bit, std::memory_order_relaxed);
+        }
+    }
+
+    //whoever loses the race to allocate a chunk throws its own away and uses the winners
+    auto chunk(const int32_t x, const int32_t y, const int32_t z) -> Chunk*
+    {
+        auto& a = chunks_[chunkIndex(x,y,z)];
+        Chunk* c = a.load(std::memory_order_acquire);
+        if(c) { return c; }
+
+        auto* const fresh = new Chunk;
+        if(occupancy_) { fresh->occupancy = std::make_unique<Occupancy>(); }
+        if(a.compare_exchange_strong(c, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            return fresh;
+        }
+        delete fresh;
+        return c;
+    }
+
+    auto release() -> void
+    {
+        for(auto& a : chunks_)
+        {
+            delete a.exchange(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    //levels are 1 for blocks, 2 for chunks and from 3 on the entries of levels_
+    [[nodiscard]] auto topLevel() const -> int32_t
+    {
+        return 2 + static_cast<int32_t>(levels_.size());
+    }
+
+    static constexpr auto levelBits(int32_t const level) -> int32_t
+    {
+        return level * BLOCK_BITS;
+    }
+
+    [[nodiscard]] auto levelIndex(int32_t const level, int32_t const x, int32_t const y, int32_t const z) const -> size_t
+    {
+        int32_t const bits = levelBits(level);
+        size_t const w = (static_cast<size_t>(width_) + (size_t(1) << bits) - 1) >> bits;
+        size_t const h = (static_cast<size_t>(height_) + (size_t(1) << bits) - 1) >> bits;
+        return (((static_cast<size_t>(z) * h + (y >> bits)) * w) + (x >> bits)) * COUNTED;
+    }
+
+    //a cell changed its type, only types that changed touch the counts
+    auto retype(const int32_t x, const int32_t y, const int32_t z, Type const from, Type const to) -> void
+    {
+        if(from == to) { return; }
+        Chunk* const c = chunks_[chunkIndex(x,y,z)].load(std::memory_order_acquire);
+        auto& o = *c->occupancy;
+        auto& block = o.blocks[blockIndex(x,y)];
+        if(from != Empty)
+        {
+            block[from - 1].fetch_sub(1, std::memory_order_relaxed);
+            o.chunk[from - 1].fetch_sub(1, std::memory_order_relaxed);
+        }
+        if(to != Empty)
+        {
+            block[to - 1].fetch_add(1, std::memory_order_relaxed);
+            o.chunk[to - 1].fetch_add(1, std::memory_order_relaxed);
+        }
+        for(size_t l = 0; l < levels_.size(); ++l)
+        {
+            size_t const i = levelIndex(static_cast<int32_t>(l) + 3, x, y, z);
+            if(from != Empty) { levels_[l][i + from - 1].fetch_sub(1, std::memory_order_relaxed); }
+            if(to != Empty) { levels_[l][i + to - 1].fetch_add(1, std::memory_order_relaxed); }
+        }
+    }
+
+    static constexpr auto blockIndex(const int32_t x, const int32_t y) -> int32_t
+    {
+        constexpr int32_t PER_ROW = CHUNK_SIZE / BLOCK_SIZE;
+        return ((x & CHUNK_MASK) >> BLOCK_BITS) + ((y & CHUNK_MASK) >> BLOCK_BITS) * PER_ROW;
+    }
+
+    //the blocks and the total of a chunk from its cells, cells past the edge of the grid are not counted
+    auto countChunk(const int32_t x, const int32_t y, Chunk& c) -> void
+    {
+        if(!c.occupancy) { c.occupancy = std::make_unique<Occupancy>(); }
+
+        int32_t const x0 = x & ~CHUNK_MASK;
+        int32_t const y0 = y & ~CHUNK_MASK;
+        std::array<std::array<uint8_t, COUNTED>, BLOCKS_PER_CHUNK> blocks{};
+        std::array<uint16_t, COUNTED> total{};
+        for(int32_t ly = 0; ly < std::min(CHUNK_SIZE, height_ - y0); ++ly)
+        {
+            for(int32_t lx = 0; lx < std::min(CHUNK_SIZE, width_ - x0); ++lx)
+            {
+                Type const t = c.cells[local(lx,ly)].type();
+                if(t == Empty) { continue; }
+                ++blocks[blockIndex(lx,ly)][t - 1];
+                ++total[t - 1];
+            }
+        }
+
+        for(int32_t b = 0; b < BLOCKS_PER_CHUNK; ++b)
+        {
+            for(int32_t t = 0; t < COUNTED; ++t) { c.occupancy->blocks[b][t].store(blocks[b][t], std::memory_order_relaxed); }
+        }
+        for(int32_t t = 0; t < COUNTED; ++t) { c.occupancy->chunk[t].store(total[t], std::memory_order_relaxed); }
+    }
+
+    //adds (or with sign -1 takes away) the total of a chunk to the levels above it
+    auto addToLevels(const int32_t x, const int32_t y, const int32_t z, Occupancy const & o, int32_t const sign) -> void
+    {
+        for(size_t l = 0; l < levels_.size(); ++l)
+        {
+            size_t const i = levelIndex(static_cast<int32_t>(l) + 3, x, y, z);
+            for(int32_t t = 0; t < COUNTED; ++t)
+            {
+                auto const n = static_cast<uint32_t>(o.chunk[t].load(std::memory_order_relaxed));
+                levels_[l][i + t].fetch_add(sign > 0 ? n : 0u - n, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    //count of one block of a level for the types of set, blocks of missing chunks are all Empty
+    [[nodiscard]] auto blockCount(TypeSet const set, int32_t const level, const int32_t x, const int32_t y, const int32_t z) const -> uint64_t
+    {
+        uint64_t n = 0;
+        if(level <= 2)
+        {
+            Chunk const * const c = chunks_[chunkIndex(x,y,z)].load(std::memory_order_acquire);
+            if(!c || !c->occupancy) { return 0; }
+            for(uint32_t b = set.bits(); b; b &= b - 1)
+            {
+                int32_t const t = std::countr_zero(b) - 1;
+                n += level == 1 ? c->occupancy->blocks[blockIndex(x,y)][t].load(std::memory_order_relaxed)
+                                : c->occupancy->chunk[t].load(std::memory_order_relaxed);
+            }
+            return n;
+        }
+
+        auto const & counts = levels_[level - 3];
+        size_t const i = levelIndex(level, x, y, z);
+        for(uint32_t b = set.bits(); b; b &= b - 1)
+        {
+            n += counts[i + std::countr_zero(b) - 1].load(std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+    //n <= CHUNK_SIZE cells of one chunk row, byte cells go through the TypeSet kernel 16 at a time
+    static auto countRun(TypeSet const set, Cell const * const cells, int32_t const n) -> uint64_t
+    {
+        if constexpr (sizeof(Cell) == 1 && Cell::TYPE_WIDTH == 4)
+        {
+            return std::popcount(set.match(reinterpret_cast<uint8_t const *>(cells), static_cast<uint32_t>(n)));
+        }
+        uint64_t count = 0;
+        for(int32_t i = 0; i < n; ++i) { count += set.contains(cells[i].type()); }
+        return count;
+    }
+
+    //the box x0,y0 to x1,y1 (exclusive) from the blocks of a level: blocks the box covers whole are looked up,
+    //the ones it cuts go one level down, level 0 reads the cells. stops early once limit is reached
+    [[nodiscard]] auto countBox(TypeSet const set, int32_t const level, int32_t const x0, int32_t const y0,
+                                int32_t const x1, int32_t const y1, int32_t const z, uint64_t const limit = UINT64_MAX) const -> uint64_t
+    {
+        if(level == 0 || !occupancy_)
+        {
+            uint64_t n = 0;
+            for(int32_t y = y0; y < y1; ++y)
+            {
+                for(int32_t x = x0; x < x1;)
+                {
+                    int32_t const run = std::min(x1 - x, CHUNK_SIZE - (x & CHUNK_MASK));
+                    Chunk const * const c = chunks_[chunkIndex(x,y,z)].load(std::memory_order_acquire);
+                    if(c) { n += countRun(set, c->cells.get() + local(x,y), run); }
+                    x += run;
+                }
+                if(n >= limit) { return n; }
+            }
+            return n;
+        }
+
+        int32_t const bits = levelBits(level);
+        int64_t const size = int64_t(1) << bits;
+        uint64_t n = 0;
+        for(int64_t by = (y0 >> bits) << bits; by < y1; by += size)
+        {
+            for(int64_t bx = (x0 >> bits) << bits; bx < x1; bx += size)
+            {
+                auto const bx0 = static_cast<int32_t>(bx);
+                auto const by0 = static_cast<int32_t>(by);
+                //a missing chunk is Empty all the way down
+                if(level <= 2 && !chunks_[chunkIndex(bx0, by0, z)].load(std::memory_order_relaxed)) { continue; }
+
+                int32_t const bx1 = static_cast<int32_t>(std::min<int64_t>(bx + size, width_));
+                int32_t const by1 = static_cast<int32_t>(std::min<int64_t>(by + size, height_));
+                //blocks without any of the types are skipped whole, however much of them the box cuts
+                uint64_t const inBlock = blockCount(set, level, bx0, by0, z);
+                if(inBlock == 0) { continue; }
+
+                if(x0 <= bx0 && bx1 <= x1 && y0 <= by0 && by1 <= y1)
+                {
+                    n += inBlock;
+                }
+                else
+                {
+                    n += countBox(set, level - 1, std::max(x0, bx0), std::max(y0, by0), std::min(x1, bx1), std::min(y1, by1), z, limit - n);
+                }
+                if(n >= limit) { return n; }
+            }
+        }
+        return n;
+    }
 
 };
 
 }
-
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+
+namespace vkopter::game::citygen
+{
+
+//counter based generator, the n-th number of a stream is mix(key + n * GOLDEN) (splitmix64).
+//a stream is nothing but its key and a counter, so every tile, site or worker can start its own
+//reproducible stream from the seed and a few ids without sharing any state between threads
+class Rng
+{
+public:
+    using result_type = uint64_t;
+
+    static constexpr uint64_t DEFAULT_SEED = 87735410;
+
+    explicit Rng(uint64_t const seed = DEFAULT_SEED) :
+        key_(mix(seed))
+    {
+    }
+
+    //independent stream for the ids a, b, c under seed, the same ids always give the same numbers
+    static auto stream(uint64_t const seed, uint64_t const a, uint64_t const b = 0, uint64_t const c = 0) -> Rng
+    {
+        Rng r;
+        r.key_ = mix(mix(mix(mix(seed) ^ a) ^ b) ^ c);
+        return r;
+    }
+
+    auto next() -> uint64_t
+    {
+        return mix(key_ + (++counter_) * GOLDEN);
+    }
+
+    auto operator () () -> uint64_t
+    {
+        return next();
+    }
+
+    //uniform in [0, n), multiply-shift instead of modulo. the bias is below n / 2^32, which is nothing for
+    //the grid sizes and candidate counts this is used with
+    auto below(uint32_t const n) -> uint32_t
+    {
+        return static_cast<uint32_t>(((next() >> 32) * n) >> 32);
+    }
+
+    //uniform in [a, b]
+    auto range(int32_t const a, int32_t const b) -> int32_t
+    {
+        return a + static_cast<int32_t>(below(static_cast<uint32_t>(b - a) + 1));
+    }
+
+    auto coin() -> bool
+    {
+        return next() >> 63;
+    }
+
+    //everything a stream is, to continue it later exactly where it stopped
+    struct State
+    {
+        uint64_t key;
+        uint64_t counter;
+    };
+
+    [[nodiscard]] auto state() const -> State
+    {
+        return {key_, counter_};
+    }
+
+    static auto fromState(State const s) -> Rng
+    {
+        Rng r;
+        r.key_ = s.key;
+        r.counter_ = s.counter;
+        return r;
+    }
+
+    static constexpr auto min() -> uint64_t { return 0; }
+    static constexpr auto max() -> uint64_t { return std::numeric_limits<uint64_t>::max(); }
+
+private:
+    static constexpr uint64_t GOLDEN = 0x9e3779b97f4a7c15ull;
+
+    uint64_t key_;
+    uint64_t counter_ = 0;
+
+    static constexpr auto mix(uint64_t z) -> uint64_t
+    {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+};
+
+//what an updater needs to go on exactly where it stopped: its seed, its own stream and how many parallel calls or
+//generations it has run, which key the streams of its tiles and sites
+struct UpdaterState
+{
+    uint64_t seed = Rng::DEFAULT_SEED;
+    Rng::State rng = Rng(Rng::DEFAULT_SEED).state();
+    uint64_t calls = 0;
+};
+
+}
@@ -0,0 +1,266 @@
+#pragma once
+
+#include "atom.hpp"
+#include "rng.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+#include <utility>
+
+namespace vkopter::game::citygen::rules
+{
+
+//consts for CA
+constexpr uint8_t INTERSECTION_CHANCE = 7;
+
+constexpr std::size_t MAX_CANDIDATES = 8;
+constexpr std::size_t MAX_WRITES = 4;
+constexpr std::size_t MAX_BRANCHES = 4;
+
+//the types one write can choose from, picked uniformly
+struct Candidates
+{
+    std::array<Type, MAX_CANDIDATES> types{};
+    uint8_t count = 0;
+};
+
+//writes one of cands into the cell at x,y,z if it is Empty,
+//or with a chance of altPercent (out of 0 - 100 inclusive) one of alt instead
+struct Write
+{
+    int8_t x = 0, y = 0, z = 0;
+    Candidates cands;
+    Candidates alt;
+    uint8_t altPercent = 0;
+};
+
+//all writes of a branch happen together
+struct Branch
+{
+    std::array<Write, MAX_WRITES> writes{};
+    uint8_t count = 0;
+};
+
+//a rule picks one of its branches uniformly, a rule without branches does nothing
+struct Rule
+{
+    std::array<Branch, MAX_BRANCHES> branches{};
+    uint8_t count = 0;
+};
+
+
+////////////////////////////////////////////////////////////
+//rule definition dsl, everything here only runs at compile time
+
+constexpr auto candidates(std::initializer_list<Type> const types) -> Candidates
+{
+    Candidates c;
+    for(auto const t : types)
+    {
+        c.types[c.count++] = t;
+    }
+    return c;
+}
+
+constexpr auto put(int8_t const x, int8_t const y, std::initializer_list<Type> const types) -> Write
+{
+    Write w;
+    w.x = x;
+    w.y = y;
+    w.cands = candidates(types);
+    return w;
+}
+
+constexpr auto put(int8_t const x, int8_t const y, std::initializer_list<Type> const types,
+                   uint8_t const percent, std::initializer_list<Type> const alt) -> Write
+{
+    Write w = put(x, y, types);
+    w.alt = candidates(alt);
+    w.altPercent = percent;
+    return w;
+}
+
+constexpr auto branch(std::initializer_list<Write> const writes) -> Branch
+{
+    Branch b;
+    for(auto const & w : writes)
+    {
+        b.writes[b.count++] = w;
+    }
+    return b;
+}
+
+constexpr auto either(std::initializer_list<Branch> const branches) -> Rule
+{
+    Rule r;
+    for(auto const & b : branches)
+    {
+        r.branches[r.count++] = b;
+    }
+    return r;
+}
+
+constexpr auto always(std::initializer_list<Write> const writes) -> Rule
+{
+    return either({branch(writes)});
+}
+
+
+////////////////////////////////////////////////////////////
+//the rules, indexed by Type. types without an entry do nothing
+
+constexpr auto makeTable() -> std::array<Rule, NUM_TYPES>
+{
+    std::array<Rule, NUM_TYPES> r{};
+
+    //grow north or south, sometimes ending in an intersection or a turn
+    r[RoadNS] = either({
+        branch({ put(0,-1, {RoadNS}, INTERSECTION_CHANCE, {RoadDiagBL, RoadDiagBR, Road4Way, RoadEWS, RoadNSE, RoadNSW}) }),
+        branch({ put(0, 1, {RoadNS}, INTERSECTION_CHANCE, {RoadDiagTL, RoadDiagTR, Road4Way, RoadEWN, RoadNSE, RoadNSW}) })
+    });
+
+    //grow west or east
+    r[RoadEW] = either({
+        branch({ put(-1,0, {RoadEW}, INTERSECTION_CHANCE, {RoadDiagBR, RoadDiagTR, Road4Way, RoadEWN, RoadEWS, RoadNSE}) }),
+        branch({ put( 1,0, {RoadEW}, INTERSECTION_CHANCE, {RoadDiagBL, RoadDiagTL, Road4Way, RoadEWN, RoadEWS, RoadNSW}) })
+    });
+
+    //turns keep going diagonally, sometimes straightening out
+    r[RoadDiagBL] = either({
+        branch({ put(0, 1, {RoadDiagTR}, INTERSECTION_CHANCE, {RoadNS}) }),
+        branch({ put(-1,0, {RoadDiagTR}, INTERSECTION_CHANCE, {RoadEW}) })
+    });
+    r[RoadDiagBR] = either({
+        branch({ put(0, 1, {RoadDiagTL}, INTERSECTION_CHANCE, {RoadNS}) }),
+        branch({ put(1, 0, {RoadDiagTL}, INTERSECTION_CHANCE, {RoadEW}) })
+    });
+    r[RoadDiagTR] = either({
+        branch({ put(0,-1, {RoadDiagBL}, INTERSECTION_CHANCE, {RoadNS}) }),
+        branch({ put(1, 0, {RoadDiagBL}, INTERSECTION_CHANCE, {RoadEW}) })
+    });
+    r[RoadDiagTL] = either({
+        branch({ put(0,-1, {RoadDiagBR}, INTERSECTION_CHANCE, {RoadNS}) }),
+        branch({ put(-1,0, {RoadDiagBR}, INTERSECTION_CHANCE, {RoadEW}) })
+    });
+
+    //intersections start a road on every open side
+    r[Road4Way] = always({ put(-1,0, {RoadEW}), put(1,0, {RoadEW}), put(0,1, {RoadNS}), put(0,-1, {RoadNS}) });
+    r[RoadEWN]  = always({ put( 1,0, {RoadEW}), put(-1,0, {RoadEW}), put(0,-1, {RoadNS}) });
+    r[RoadEWS]  = always({ put( 1,0, {RoadEW}), put(-1,0, {RoadEW}), put(0, 1, {RoadNS}) });
+    r[RoadNSE]  = always({ put(0,-1, {RoadNS}), put(0, 1, {RoadNS}), put(1, 0, {RoadEW}) });
+    r[RoadNSW]  = always({ put(0,-1, {RoadNS}), put(0, 1, {RoadNS}), put(-1,0, {RoadEW}) });
+
+    return r;
+}
+
+constexpr std::array<Rule, NUM_TYPES> TABLE = makeTable();
+
+
+////////////////////////////////////////////////////////////
+//things the schedulers need to know about the rules, derived from TABLE
+
+//furthest any rule writes from its site
+constexpr int32_t REACH = []()
+{
+    auto const abs = [](int32_t const v) { return v < 0 ? -v : v; };
+    int32_t reach = 0;
+    for(auto const & r : TABLE)
+    {
+        for(uint8_t b = 0; b < r.count; ++b)
+        {
+            for(uint8_t w = 0; w < r.branches[b].count; ++w)
+            {
+                auto const & wr = r.branches[b].writes[w];
+                reach = std::max({reach, abs(wr.x), abs(wr.y), abs(wr.z)});
+            }
+        }
+    }
+    return reach;
+}();
+
+constexpr auto target(int32_t const x, int32_t const y, int32_t const z = 0) -> uint32_t
+{
+    return 1u << ((x + REACH) + (y + REACH) * (2 * REACH + 1) + (z + REACH) * (2 * REACH + 1) * (2 * REACH + 1));
+}
+
+static_assert((2 * REACH + 1) * (2 * REACH + 1) * (2 * REACH + 1) <= 32, "target masks only fit a reach of 1");
+
+//cells each rule can write to, a site whose targets are all taken can never change again
+constexpr std::array<uint32_t, NUM_TYPES> TARGETS = []()
+{
+    std::array<uint32_t, NUM_TYPES> t{};
+    for(std::size_t i = 0; i < NUM_TYPES; ++i)
+    {
+        for(uint8_t b = 0; b < TABLE[i].count; ++b)
+        {
+            for(uint8_t w = 0; w < TABLE[i].branches[b].count; ++w)
+            {
+                auto const & wr = TABLE[i].branches[b].writes[w];
+                t[i] |= target(wr.x, wr.y, wr.z);
+            }
+        }
+    }
+    return t;
+}();
+
+
+////////////////////////////////////////////////////////////
+//the kernels, one per type, unrolled from TABLE at compile time so the offsets are constants
+
+template<Write const & w, class Window>
+auto write(Window& ew, Rng& gen) -> void
+{
+    Atom& a = ew(w.x, w.y, w.z);
+    if(a.type != Empty) { return; }
+
+    bool alt = false;
+    if constexpr (w.altPercent > 0)
+    {
+        alt = gen.below(101) <= w.altPercent;
+    }
+    Candidates const & c = alt ? w.alt : w.cands;
+    a = c.types[c.count == 1 ? 0 : gen.below(c.count)];
+}
+
+template<Branch const & b, class Window>
+auto apply(Window& ew, Rng& gen) -> void
+{
+    [&]<std::size_t... I>(std::index_sequence<I...>)
+    {
+        (write<b.writes[I]>(ew, gen), ...);
+    }(std::make_index_sequence<b.count>{});
+}
+
+template<std::size_t T, class Window>
+auto apply(Window& ew, Rng& gen) -> void
+{
+    if constexpr (TABLE[T].count == 1)
+    {
+        apply<TABLE[T].branches[0]>(ew, gen);
+    }
+    else if constexpr (TABLE[T].count > 1)
+    {
+        uint32_t const chosen = gen.below(TABLE[T].count);
+        [&]<std::size_t... I>(std::index_sequence<I...>)
+        {
+            ((chosen == I ? apply<TABLE[T].branches[I]>(ew, gen) : void()), ...);
+        }(std::make_index_sequence<TABLE[T].count>{});
+    }
+}
+
+template<class Window>
+constexpr std::array<void (*)(Window&, Rng&), NUM_TYPES> KERNELS = []<std::size_t... T>(std::index_sequence<T...>)
+{
+    return std::array<void (*)(Window&, Rng&), NUM_TYPES>{ &apply<T, Window>... };
+}(std::make_index_sequence<NUM_TYPES>{});
+
+//runs the rule of type on the window
+template<class Window>
+auto apply(Type const type, Window& ew, Rng& gen) -> void
+{
+    KERNELS<Window>[type](ew, gen);
+}
+
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace vkopter::game::citygen
+{
+
+//dense set of site indices with O(1) insert, erase and uniform sampling by position.
+//the index from site to slot is paged, pages are only allocated for sites that were inserted,
+//so a set over a huge sparse grid stays as small as the part of the grid that is in use
+class SiteSet
+{
+public:
+    explicit SiteSet(std::size_t const numSites = 0)
+    {
+        reset(numSites);
+    }
+
+    auto reset(std::size_t const numSites) -> void
+    {
+        sites_.clear();
+        pages_.clear();
+        pages_.resize((numSites + PAGE_SIZE - 1) / PAGE_SIZE);
+    }
+
+    auto insert(uint32_t const site) -> void
+    {
+        auto& page = pages_[site / PAGE_SIZE];
+        if(!page)
+        {
+            page = std::make_unique<Page>();
+            page->fill(NONE);
+        }
+
+        uint32_t& slot = (*page)[site % PAGE_SIZE];
+        if(slot != NONE) { return; }
+        slot = static_cast<uint32_t>(sites_.size());
+        sites_.push_back(site);
+    }
+
+    auto erase(uint32_t const site) -> void
+    {
+        uint32_t const slot = slotOf(site);
+        if(slot == NONE) { return; }
+
+        //move the last site into the hole
+        uint32_t const last = sites_.back();
+        sites_[slot] = last;
+        slotRef(last) = slot;
+        sites_.pop_back();
+        slotRef(site) = NONE;
+    }
+
+    [[nodiscard]] auto contains(uint32_t const site) const -> bool
+    {
+        return slotOf(site) != NONE;
+    }
+
+    [[nodiscard]] auto size() const -> std::size_t
+    {
+        return sites_.size();
+    }
+
+    [[nodiscard]] auto empty() const -> bool
+    {
+        return sites_.empty();
+    }
+
+    auto operator[](std::size_t const i) const -> uint32_t
+    {
+        return sites_[i];
+    }
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+    static constexpr uint32_t PAGE_SIZE = 4096;
+
+    using Page = std::array<uint32_t, PAGE_SIZE>;
+
+    std::vector<uint32_t> sites_;
+    std::vector<std::unique_ptr<Page>> pages_;
+
+    [[nodiscard]] auto slotOf(uint32_t const site) const -> uint32_t
+    {
+        auto const & page = pages_[site / PAGE_SIZE];
+        return page ? (*page)[site % PAGE_SIZE] : NONE;
+    }
+
+    //only for sites that are in the set, their page exists
+    auto slotRef(uint32_t const site) -> uint32_t&
+    {
+        return (*pages_[site / PAGE_SIZE])[site % PAGE_SIZE];
+    }
+};
+
+}
@@ -0,0 +1,350 @@
+#pragma once
+
+#include "atom.hpp"
+#include "grid.hpp"
+#include "rng.hpp"
+#include "rules.hpp"
+#include "typeset.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <barrier>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace vkopter::game::citygen
+{
+
+//what happens when several sites want to write into the same Empty cell in one generation
+enum class Conflict : uint8_t
+{
+    Random = 0, //one of them wins, picked by a per site and generation priority
+    LowestSite, //the site first in row major order wins, like a sequential sweep would
+    Drop        //the cell stays Empty unless they all want to write the same, they can retry next generation
+};
+
+//synchronous alternative to AtomUpdater: every site fires once per generation, all of them see the grid as it
+//was before the generation. a generation is computed by pulling: every Empty cell evaluates the rules of the
+//live sites around it whose writes can land on it and resolves them with the conflict policy. that way every cell
+//is decided by exactly one thread without any atomics, and the result does not depend on the number of threads.
+//the writes of a generation are collected first and committed after every thread has finished reading, which is
+//double buffering with a back buffer that only holds what changed. grids have to be planar (depth 1)
+template<class Cell = GridCell>
+class SyncUpdater
+{
+public:
+    using GridType = Grid<Cell>;
+
+    explicit SyncUpdater(GridType& g, Conflict const conflict = Conflict::Random) :
+        grid_(g),
+        conflict_(conflict)
+    {
+        assert(g.depth() == 1);
+    }
+
+    //one generation, returns the number of cells that changed
+    auto step(uint32_t threads = 0) -> uint64_t
+    {
+        int32_t const chunksX = (grid_.width() + C - 1) / C;
+        int32_t const chunksY = (grid_.height() + C - 1) / C;
+
+        if(threads == 0) { threads = std::thread::hardware_concurrency(); }
+        threads = std::clamp<uint32_t>(threads, 1, static_cast<uint32_t>(chunksY));
+
+        uint64_t const generation = generation_++;
+        writes_.resize(threads);
+        std::barrier sync(threads);
+        std::atomic<uint64_t> changed = 0;
+
+        //chunk rows are dealt out round robin, which keeps the populated middle of a city spread over all threads
+        auto worker = [&](uint32_t const w)
+        {
+            auto& out = writes_[w];
+            out.clear();
+            Halo halo;
+            for(int32_t cy = static_cast<int32_t>(w); cy < chunksY; cy += static_cast<int32_t>(threads))
+            {
+                for(int32_t cx = 0; cx < chunksX; ++cx)
+                {
+                    if(nearChunk(cx, cy, chunksX, chunksY))
+                    {
+                        pull(cx, cy, generation, halo, out);
+                    }
+                }
+            }
+
+            sync.arrive_and_wait();
+            for(auto const & [x, y, a] : out)
+            {
+                grid_.set(x, y, 0, a);
+            }
+            changed.fetch_add(out.size(), std::memory_order_relaxed);
+        };
+
+        std::vector<std::jthread> pool;
+        pool.reserve(threads - 1);
+        for(uint32_t w = 1; w < threads; ++w)
+        {
+            pool.emplace_back(worker, w);
+        }
+        worker(0);
+        pool.clear();
+        return changed.load(std::memory_order_relaxed);
+    }
+
+    //runs generations until one changes nothing or steps ran, returns the number of generations that ran
+    auto run(uint64_t const steps, uint32_t const threads = 0) -> uint64_t
+    {
+        for(uint64_t i = 0; i < steps; ++i)
+        {
+            if(step(threads) == 0) { return i + 1; }
+        }
+        return steps;
+    }
+
+    //same seed, same grid and same number of steps give the same city, 0 picks a seed from the clock
+    auto seedRNG(uint64_t s = 0) -> void
+    {
+        seed_ = s ? s : static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+        generation_ = 0;
+    }
+
+    auto setConflict(Conflict const c) -> void
+    {
+        conflict_ = c;
+    }
+
+    [[nodiscard]] auto generation() const -> uint64_t
+    {
+        return generation_;
+    }
+
+    //there is no stream of its own, every site draws from one keyed on the seed and the generation
+    [[nodiscard]] auto state() const -> UpdaterState
+    {
+        return {seed_, Rng(seed_).state(), generation_};
+    }
+
+    auto restore(UpdaterState const & s) -> void
+    {
+        seed_ = s.seed;
+        generation_ = s.calls;
+    }
+
+private:
+    static constexpr int32_t C = GridType::CHUNK_SIZE;
+    static constexpr int32_t R = rules::REACH;
+    //a cell pulls from the sites R around it and their rules read R around those, so the chunk needs 2R cells of
+    //its neighbours around it
+    static constexpr int32_t BORDER = 2 * R;
+    static constexpr int32_t HALO = C + 2 * BORDER;
+    static constexpr int32_t STRIDE = (HALO + 15) & ~15; //rows padded to whole vectors, so no loop needs a tail
+
+    //the chunk with BORDER cells of its neighbours around it, linearized
+    using Halo = std::array<Cell, STRIDE * HALO>;
+
+    struct Write
+    {
+        int32_t x, y;
+        Atom atom;
+    };
+
+    //a rule evaluated against the previous generation, the whole reach is read up front
+    class PullWindow
+    {
+    public:
+        static constexpr int32_t DIM = 2 * R + 1;
+
+        explicit PullWindow(Cell const * const site)
+        {
+            for(int32_t y = -R; y <= R; ++y)
+            {
+                for(int32_t x = -R; x <= R; ++x)
+                {
+                    cells_[key(x,y)] = site[x + y * STRIDE].unpack();
+                }
+            }
+        }
+
+        auto operator () (int32_t const x, int32_t const y, int32_t const z = 0) -> Atom&
+        {
+            if(z != 0)
+            {
+                sink_ = Empty;
+                return sink_;
+            }
+            return cells_[key(x,y)];
+        }
+
+        [[nodiscard]] auto at(int32_t const x, int32_t const y) const -> Atom const &
+        {
+            return cells_[key(x,y)];
+        }
+
+    private:
+        std::array<Atom, DIM * DIM> cells_;
+        Atom sink_;
+
+        static constexpr auto key(int32_t const x, int32_t const y) -> int32_t
+        {
+            return (x + R) + (y + R) * DIM;
+        }
+    };
+
+    //types that have a rule
+    static constexpr TypeSet LIVE = []()
+    {
+        TypeSet live;
+        for(std::size_t t = 0; t < NUM_TYPES; ++t)
+        {
+            if(rules::TARGETS[t]) { live.insert(static_cast<Type>(t)); }
+        }
+        return live;
+    }();
+
+    //cells the TypeSet byte kernels can classify in place
+    static constexpr bool BYTE_CELLS = sizeof(Cell) == 1 && Cell::TYPE_WIDTH == 4;
+
+    GridType& grid_;
+    Conflict conflict_;
+    uint64_t seed_ = Rng::DEFAULT_SEED;
+    uint64_t generation_ = 0;
+    std::vector<std::vector<Write>> writes_;
+
+    //a chunk can only change if it or a neighbour exists, everything else is Empty with nothing around to grow from
+    [[nodiscard]] auto nearChunk(int32_t const cx, int32_t const cy, int32_t const chunksX, int32_t const chunksY) const -> bool
+    {
+        for(int32_t y = std::max(cy - 1, 0); y <= std::min(cy + 1, chunksY - 1); ++y)
+        {
+            for(int32_t x = std::max(cx - 1, 0); x <= std::min(cx + 1, chunksX - 1); ++x)
+            {
+                if(grid_.hasChunk(x * C, y * C)) { return true; }
+            }
+        }
+        return false;
+    }
+
+    auto pull(int32_t const cx, int32_t const cy, uint64_t const generation, Halo& halo, std::vector<Write>& out) const -> void
+    {
+        int32_t const x0 = cx * C;
+        int32_t const y0 = cy * C;
+        grid_.copyRegion(x0 - BORDER, y0 - BORDER, 0, STRIDE, HALO, halo);
+
+        //which cells hold a site that writes anywhere, which cells have one of those in reach, and which of
+        //those are Empty. the first is a TypeSet kernel, the others plain byte loops over rows that the compiler
+        //vectorizes, only the few cells left get looked at one by one
+        std::array<uint8_t, STRIDE * HALO> live;
+        if constexpr (BYTE_CELLS)
+        {
+            LIVE.classify(reinterpret_cast<uint8_t const *>(halo.data()), live.data(), live.size());
+        }
+        else
+        {
+            for(int32_t i = 0; i < STRIDE * HALO; ++i) { live[i] = LIVE.contains(halo[i].type()); }
+        }
+
+        std::array<uint8_t, HALO * C> across;
+        for(int32_t y = 0; y < HALO; ++y)
+        {
+            uint8_t const * const l = &live[y * STRIDE + BORDER];
+            uint8_t* const a = &across[y * C];
+            for(int32_t x = 0; x < C; ++x)
+            {
+                uint8_t v = l[x];
+                for(int32_t d = 1; d <= R; ++d) { v |= l[x - d] | l[x + d]; }
+                a[x] = v;
+            }
+        }
+
+        int32_t const w = std::min(C, grid_.width() - x0);
+        int32_t const h = std::min(C, grid_.height() - y0);
+        for(int32_t y = 0; y < h; ++y)
+        {
+            Cell const * const row = &halo[(y + BORDER) * STRIDE + BORDER];
+            int32_t const ay = y + BORDER;
+            alignas(uint64_t) std::array<uint8_t, C> candidate;
+            for(int32_t x = 0; x < C; ++x)
+            {
+                uint8_t v = across[ay * C + x];
+                for(int32_t d = 1; d <= R; ++d) { v |= across[(ay - d) * C + x] | across[(ay + d) * C + x]; }
+                candidate[x] = v & ((row[x].raw() & Cell::TYPE_MASK) == Empty);
+            }
+
+            //eight cells at a time, most rows have no candidate at all
+            for(int32_t x8 = 0; x8 < w; x8 += 8)
+            {
+                uint64_t word;
+                std::memcpy(&word, &candidate[x8], sizeof(word));
+                while(word)
+                {
+                    int32_t const x = x8 + std::countr_zero(word) / 8;
+                    word &= word - 1;
+                    if(x >= w) { break; }
+
+                    Atom a;
+                    if(resolve(row + x, x0 + x, y0 + y, generation, a))
+                    {
+                        out.push_back({x0 + x, y0 + y, a});
+                    }
+                }
+            }
+        }
+    }
+
+    //the Empty cell at x,y (c in the halo) asks every site in reach whose rule can write to it what it writes
+    auto resolve(Cell const * const c, int32_t const x, int32_t const y, uint64_t const generation, Atom& result) const -> bool
+    {
+        bool found = false;
+        bool contested = false;
+        uint64_t best = 0;
+
+        for(int32_t dy = -R; dy <= R; ++dy)
+        {
+            for(int32_t dx = -R; dx <= R; ++dx)
+            {
+                Cell const * const site = c - dx - dy * STRIDE;
+                Type const type = site->type();
+                if(!(rules::TARGETS[type] & rules::target(dx, dy))) { continue; }
+
+                int32_t const sx = x - dx;
+                int32_t const sy = y - dy;
+                if(!grid_.isInBounds(sx, sy)) { continue; }
+
+                //the stream of a site is the same for every cell that asks, so they all see the same choices
+                uint64_t const siteIndex = static_cast<uint64_t>(sy) * grid_.width() + sx;
+                Rng gen = Rng::stream(seed_, generation, siteIndex);
+                PullWindow ew(site);
+                rules::apply(type, ew, gen);
+
+                Atom const a = ew.at(dx, dy);
+                if(a.type == Empty) { continue; }
+
+                uint64_t const priority = conflict_ == Conflict::Random ? Rng::stream(seed_, generation, siteIndex, 1).next()
+                                                                        : ~siteIndex;
+                if(!found)
+                {
+                    result = a;
+                    best = priority;
+                    found = true;
+                    continue;
+                }
+
+                contested = contested || a.type != result.type || a.data != result.data;
+                if(priority > best)
+                {
+                    result = a;
+                    best = priority;
+                }
+            }
+        }
+        return found && !(contested && conflict_ == Conflict::Drop);
+    }
+};
+
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include "atom.hpp"
+
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define VKOPTER_TYPESET_SSE2 1
+#endif
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>
+#define VKOPTER_TYPESET_SSSE3 1
+#endif
+
+namespace vkopter::game::citygen
+{
+
+//set of Types as a bitmask, one bit per type. membership, union and intersection are single instructions and
+//the set fits a register, so rules can ask neighbourhood questions without building vectors of types.
+//the byte kernels test packed cells (type in the low 4 bits of a byte, like GridCell) 16 at a time:
+//with SSSE3 through a pshufb table, with plain SSE2 as a range check when the set is one run of types and
+//through one compare per member otherwise, and with a scalar loop everywhere else
+class TypeSet
+{
+public:
+    using word_type = uint32_t;
+
+    static_assert(NUM_TYPES <= 32, "every Type needs a bit");
+
+    constexpr TypeSet() = default;
+
+    constexpr TypeSet(std::initializer_list<Type> const types)
+    {
+        for(auto const t : types) { insert(t); }
+    }
+
+    explicit TypeSet(std::vector<Type> const & types)
+    {
+        for(auto const t : types) { insert(t); }
+    }
+
+    //first to last inclusive
+    static constexpr auto range(Type const first, Type const last) -> TypeSet
+    {
+        TypeSet s;
+        for(uint32_t t = first; t <= last; ++t) { s.insert(static_cast<Type>(t)); }
+        return s;
+    }
+
+    static constexpr auto all() -> TypeSet
+    {
+        return range(Empty, static_cast<Type>(NUM_TYPES - 1));
+    }
+
+    static constexpr auto fromBits(word_type const bits) -> TypeSet
+    {
+        TypeSet s;
+        s.bits_ = bits & all().bits_;
+        return s;
+    }
+
+    [[nodiscard]] constexpr auto contains(Type const t) const -> bool
+    {
+        return t < 32 && ((bits_ >> t) & 1);
+    }
+
+    constexpr auto insert(Type const t) -> TypeSet&
+    {
+        bits_ |= word_type{1} << t;
+        return *this;
+    }
+
+    constexpr auto erase(Type const t) -> TypeSet&
+    {
+        bits_ &= ~(word_type{1} << t);
+        return *this;
+    }
+
+    [[nodiscard]] constexpr auto bits() const -> word_type { return bits_; }
+    [[nodiscard]] constexpr auto empty() const -> bool { return bits_ == 0; }
+    [[nodiscard]] constexpr auto size() const -> uint32_t { return std::popcount(bits_); }
+
+    constexpr auto operator | (TypeSet const that) const -> TypeSet { return fromBits(bits_ | that.bits_); }
+    constexpr auto operator & (TypeSet const that) const -> TypeSet { return fromBits(bits_ & that.bits_); }
+    constexpr auto operator - (TypeSet const that) const -> TypeSet { return fromBits(bits_ & ~that.bits_); }
+    constexpr auto operator ~ () const -> TypeSet { return fromBits(~bits_); }
+    constexpr auto operator == (TypeSet const &) const -> bool = default;
+
+    //bit i of the result is set when the type in the low 4 bits of p[i] is in the set.
+    //always reads all 16 bytes, whoever calls it makes sure they are there
+    [[nodiscard]] auto match16(uint8_t const * const p) const -> uint16_t
+    {
+#if defined(VKOPTER_TYPESET_SSE2)
+        return static_cast<uint16_t>(_mm_movemask_epi8(members(_mm_loadu_si128(reinterpret_cast<__m128i const *>(p)))));
+#else
+        uint16_t m = 0;
+        for(uint32_t i = 0; i < 16; ++i)
+        {
+            m |= static_cast<uint16_t>(((bits_ >> (p[i] & 0x0F)) & 1) << i);
+        }
+        return m;
+#endif
+    }
+
+    //match16 for up to 64 bytes, bits from n on are 0. reads whole blocks of 16 like match16
+    [[nodiscard]] auto match(uint8_t const * const p, uint32_t const n) const -> uint64_t
+    {
+        uint64_t m = 0;
+        for(uint32_t i = 0; i < n; i += 16)
+        {
+            m |= static_cast<uint64_t>(match16(p + i)) << i;
+        }
+        return n >= 64 ? m : m & ((uint64_t{1} << n) - 1);
+    }
+
+    //out[i] = 1 when the type in the low 4 bits of p[i] is in the set, 0 otherwise
+    auto classify(uint8_t const * const p, uint8_t* const out, std::size_t const n) const -> void
+    {
+        std::size_t i = 0;
+#if defined(VKOPTER_TYPESET_SSE2)
+        __m128i const one = _mm_set1_epi8(1);
+        for(; i + 16 <= n; i += 16)
+        {
+            __m128i const in = members(_mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_and_si128(in, one));
+        }
+#endif
+        for(; i < n; ++i)
+        {
+            out[i] = static_cast<uint8_t>((bits_ >> (p[i] & 0x0F)) & 1);
+        }
+    }
+
+private:
+    word_type bits_ = 0;
+
+#if defined(VKOPTER_TYPESET_SSE2)
+    //0xFF in every lane whose type is in the set
+    [[nodiscard]] auto members(__m128i const cells) const -> __m128i
+    {
+        __m128i const types = _mm_and_si128(cells, _mm_set1_epi8(0x0F));
+#if defined(VKOPTER_TYPESET_SSSE3)
+        //the table has lane t set when bit t of the set is, built from the two bytes of the mask
+        auto const low = static_cast<char>(bits_ & 0xFF);
+        auto const high = static_cast<char>((bits_ >> 8) & 0xFF);
+        __m128i const select = _mm_set_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+        __m128i const spread = _mm_set_epi8(high, high, high, high, high, high, high, high, low, low, low, low, low, low, low, low);
+        __m128i const table = _mm_cmpeq_epi8(_mm_and_si128(spread, select), select);
+        return _mm_shuffle_epi8(table, types);
+#else
+        //one run of types is a subtract and an unsigned compare, anything else one compare per member
+        uint32_t const first = std::countr_zero(bits_ | 0x10000u);
+        uint32_t const run = bits_ >> first;
+        if(bits_ != 0 && (run & (run + 1)) == 0)
+        {
+            auto const last = static_cast<char>(std::bit_width(run) - 1);
+            __m128i const d = _mm_sub_epi8(types, _mm_set1_epi8(static_cast<char>(first)));
+            return _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(last)), d);
+        }
+
+        __m128i in = _mm_setzero_si128();
+        for(uint32_t b = bits_ & 0xFFFF; b; b &= b - 1)
+        {
+            in = _mm_or_si128(in, _mm_cmpeq_epi8(types, _mm_set1_epi8(static_cast<char>(std::countr_zero(b)))));
+        }
+        return in;
+#endif
+    }
+#endif
+};
+
+[[nodiscard]] constexpr auto operator == (Atom const & a, TypeSet const s) -> bool
+{
+    return s.contains(a.type);
+}
+
+[[nodiscard]] constexpr auto operator != (Atom const & a, TypeSet const s) -> bool
+{
+    return !s.contains(a.type);
+}
+
+template<std::unsigned_integral Word, uint8_t TYPE_BITS>
+[[nodiscard]] auto operator == (PackedAtom<Word, TYPE_BITS> const & a, TypeSet const s) -> bool
+{
+    return s.contains(a.type());
+}
+
+template<std::unsigned_integral Word, uint8_t TYPE_BITS>
+[[nodiscard]] auto operator != (PackedAtom<Word, TYPE_BITS> const & a, TypeSet const s) -> bool
+{
+    return !s.contains(a.type());
+}
+
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "util/array2d.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace vkopter::game
+{
+
+//terrain can only be drawn where no tile is more than one above any of its four neighbours. both functions here
+//lower a heightmap until that holds, with the map standing between two columns of border tiles on the left and
+//the right, the border is never lowered.
+//the highest heights that hold are h'(p) = min over every q of h(q) + |px - qx| + |py - qy|, border tiles
+//included: a distance transform in the city block metric with the old heights as the distances at the sources.
+//nothing above h' holds since every q bounds p that way, and h' holds since a min of such cones steps by at most
+//one. both functions compute exactly h', in a fixed number of passes and for every input
+
+//the two ordered sweeps, one from the top left and one back from the bottom right, every tile ends up at most one
+//above the lower of the two neighbours the sweep came from. a row is first clamped against the row before it,
+//which vectorizes, and then against its own tiles in order, which is one long chain and stays serial
+template<class T>
+auto sweepSlopes(Vector2d<T>& map, uint32_t const border) -> void
+{
+    size_t const width = map.getWidth();
+    size_t const height = map.getHeight();
+    if(width == 0 || height == 0) { return; }
+
+    auto const clamp = [](T& h, uint32_t const next) { if(h > next) { h = static_cast<T>(next); } };
+
+    for(size_t y = 0; y < height; ++y)
+    {
+        T* const row = &map(0, y);
+        if(y > 0)
+        {
+            T const * const above = &map(0, y - 1);
+            for(size_t x = 0; x < width; ++x) { row[x] = static_cast<T>(std::min<uint32_t>(row[x], above[x] + 1u)); }
+        }
+        clamp(row[0], border + 1);
+        for(size_t x = 1; x < width; ++x) { clamp(row[x], row[x - 1] + 1u); }
+    }
+
+    for(size_t y = height; y-- > 0;)
+    {
+        T* const row = &map(0, y);
+        if(y < height - 1)
+        {
+            T const * const below = &map(0, y + 1);
+            for(size_t x = 0; x < width; ++x) { row[x] = static_cast<T>(std::min<uint32_t>(row[x], below[x] + 1u)); }
+        }
+        clamp(row[width - 1], border + 1);
+        for(size_t x = width - 1; x-- > 0;) { clamp(row[x], row[x + 1] + 1u); }
+    }
+}
+
+//the city block distance splits into a distance along the row and one along the column, so h' is a transform of
+//every row on its own (with the border) followed by one of every column on its own. no row needs another row and
+//no column another column, so both passes are dealt out to threads, and neither has to be repeated.
+//rows go to threads in bands, each row is walked both ways while it is in cache. columns go to threads in strips
+//as wide as the map allows, a strip row is contiguous and clamping it against the next one vectorizes
+template<class T>
+auto solveSlopes(Vector2d<T>& map, uint32_t const border, uint32_t threads = 0) -> void
+{
+    size_t const width = map.getWidth();
+    size_t const height = map.getHeight();
+    if(width == 0 || height == 0) { return; }
+
+    if(threads == 0) { threads = std::thread::hardware_concurrency(); }
+    threads = std::max<uint32_t>(threads, 1);
+
+    //runs pass(first, last) over [0, count) in one contiguous band per thread
+    auto const parallel = [threads](size_t const count, auto const & pass)
+    {
+        size_t const n = std::min<size_t>(threads, count);
+        size_t const band = (count + n - 1) / n;
+        std::vector<std::jthread> pool;
+        for(size_t t = 1; t < n; ++t)
+        {
+            pool.emplace_back([&pass, t, band, count] { pass(t * band, std::min(count, (t + 1) * band)); });
+        }
+        pass(0, std::min(count, band));
+    };
+
+    T* const data = map.data();
+
+    parallel(height, [&](size_t const first, size_t const last)
+    {
+        for(size_t y = first; y < last; ++y)
+        {
+            T* const row = data + y * width;
+            uint32_t prev = border;
+            for(size_t x = 0; x < width; ++x)
+            {
+                prev = std::min<uint32_t>(row[x], prev + 1);
+                row[x] = static_cast<T>(prev);
+            }
+            prev = border;
+            for(size_t x = width; x-- > 0;)
+            {
+                prev = std::min<uint32_t>(row[x], prev + 1);
+                row[x] = static_cast<T>(prev);
+            }
+        }
+    });
+
+    //strips are whole cache lines wide so no two threads write the same line
+    constexpr size_t LINE = std::max<size_t>(64 / sizeof(T), 1);
+    size_t const strip = std::max(LINE, (width / threads + LINE - 1) / LINE * LINE);
+    parallel((width + strip - 1) / strip, [&](size_t const first, size_t const last)
+    {
+        size_t const x0 = first * strip;
+        size_t const w = std::min(width, last * strip) - x0;
+
+        for(size_t y = 1; y < height; ++y)
+        {
+            T* const row = data + y * width + x0;
+            T const * const above = row - width;
+            for(size_t x = 0; x < w; ++x) { row[x] = static_cast<T>(std::min<uint32_t>(row[x], above[x] + 1u)); }
+        }
+        for(size_t y = height - 1; y-- > 0;)
+        {
+            T* const row = data + y * width + x0;
+            T const * const below = row + width;
+            for(size_t x = 0; x < w; ++x) { row[x] = static_cast<T>(std::min<uint32_t>(row[x], below[x] + 1u)); }
+        }
+    });
+}
+
+}
@@ -1,10 +1,16 @@
 #pragma once
 
-#include <bit>
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <vector>
+#include "slopes.hpp"
+#include "terrainfile.hpp"
 #include "util/array2d.hpp"
-#include <SDL2/SDL.h>
-#include <glm/vec2.hpp>
+#include "util/stb_image.h"
 
 namespace vkopter::game
 {
@@ -13,6 +19,14 @@ namespace vkopter::game
 class Terrain
 {
 public:
+    //tiles x to x + w and y to y + h
+    struct Rect
+    {
+        uint32_t x = 0, y = 0, w = 0, h = 0;
+
+        [[nodiscard]] auto empty() const -> bool { return w == 0 || h == 0; }
+    };
+
     explicit Terrain()
     {
         clear();
@@ -24,39 +38,68 @@ public:
     }
 
 
+    //opens a terrain file and sizes the maps for it without reading any of it, loadRegion() pages in the parts
+    //that are needed
     void load(std::string const & path)
     {
-
-        SDL_Surface* surf = SDL_LoadBMP(path.c_str());
-
-        auto getpixel = [surf](size_t const x, size_t const y, const uint8_t c = 0) -> uint8_t
-        {
-            //c = 0 for red, 1 for green, 2 for blue (assuming RGB format)
-            if(x >= surf->w || y >= surf->h) {return 0;}
-            auto* pix = std::bit_cast<uint8_t*>(surf->pixels);
-            return pix[3 * ((y) * surf -> w + x) + c];
-        };
-
-        width_ = surf->w;
-        height_ = surf->h;
+        file_ = std::make_unique<TerrainFile>(path);
+        width_ = file_->width();
+        height_ = file_->height();
 
         altmap_.resize(width_,height_);
         termap_.resize(width_,height_);
+        loaded_.assign(size_t(file_->tilesX()) * file_->tilesY(), false);
+    }
 
+    //copies the tiles of the terrain file that overlap the rectangle and were not copied before into the maps and
+    //returns how many that were, so the cost is the tiles in view and not the map
+    auto loadRegion(int64_t const x, int64_t const y, int64_t const w, int64_t const h) -> size_t
+    {
+        if(!file_) { return 0; }
 
-        for(int32_t y = 0; y < height_; ++y)
+        constexpr int64_t T = TerrainFile::TILE;
+        int64_t const tx0 = std::max<int64_t>(x, 0) / T;
+        int64_t const ty0 = std::max<int64_t>(y, 0) / T;
+        int64_t const tx1 = std::min<int64_t>(x + w, width_);
+        int64_t const ty1 = std::min<int64_t>(y + h, height_);
+
+        size_t tiles = 0;
+        for(int64_t ty = ty0; ty * T < ty1; ++ty)
         {
-            for(uint32_t x = 0; x < width_; ++x)
+            for(int64_t tx = tx0; tx * T < tx1; ++tx)
             {
-                auto const h = getpixel(x,y);
-                altmap_(x,y) = h;
+                auto&& loaded = loaded_[ty * file_->tilesX() + tx];
+                if(loaded) { continue; }
+                file_->loadTile(tx, ty, altmap_, termap_);
+                loaded = true;
+                ++tiles;
             }
         }
+        return tiles;
+    }
 
-        SDL_FreeSurface(surf);
+    //heights from a grey BMP or PNG (the brightness of a coloured one), the tile types are left for makeValid().
+    //this and save() are the converter to terrain files
+    void loadImage(std::string const & path)
+    {
+        int w = 0, h = 0, channels = 0;
+        uint8_t* const pixels = stbi_load(path.c_str(), &w, &h, &channels, 1);
+        if(!pixels) { throw std::runtime_error("failed to load heightmap!"); }
 
-        //makeValid();
+        file_.reset();
+        loaded_.clear();
+        width_ = w;
+        height_ = h;
 
+        altmap_.resize(width_,height_);
+        termap_.resize(width_,height_);
+        std::copy_n(pixels, size_t(width_) * height_, altmap_.data());
+        stbi_image_free(pixels);
+    }
+
+    void save(std::string const & path)
+    {
+        TerrainFile::save(path, altmap_, termap_);
     }
 
     void clear()
@@ -65,178 +108,32 @@ public:
         altmap_.fill(0);
     }
 
-    void makeValid()
+    //clamps the heights so that no two neighbours differ by more than one, then picks the shape of every tile
+    //from which of its eight neighbours are higher
+    void makeValid(uint32_t const threads = 0)
     {
-        struct ter
-        {
-            uint8_t a = 0,b = 0,c = 0,d = 0;
-        };
-
-        auto selectxter = [](ter const t) -> uint8_t
-        {
-            if(t.a == 0 && t.b == 0 && t.c == 0 && t.d == 0)
-            {
-                return 0;
-            }
-            if(t.a == 1 && t.b == 1 && t.c == 0 && t.d == 0)
-            {
-                return 1;
-            }
-            if(t.a == 0 && t.b == 1 && t.c == 0 && t.d == 1)
-            {
-                return 2;
-            }
-            if(t.a == 0 && t.b == 0 && t.c == 1 && t.d == 1)
-            {
-                return 3;
-            }
-            if(t.a == 1 && t.b == 0 && t.c == 1 && t.d == 0)
-            {
-                return 4;
-            }
-            if(t.a == 1 && t.b == 1 && t.c == 0 && t.d == 1)
-            {
-                return 5;
-            }
-            if(t.a == 0 && t.b == 1 && t.c == 1 && t.d == 1)
-            {
-                return 6;
-            }
-            if(t.a == 1 && t.b == 0 && t.c == 1 && t.d == 1)
-            {
-                return 7;
-            }
-            if(t.a == 1 && t.b == 1 && t.c == 1 && t.d == 0)
-            {
-                return 8;
-            }
-            if(t.a == 0 && t.b == 1 && t.c == 0 && t.d == 0)
-            {
-                return 9;
-            }
-            if(t.a == 0 && t.b == 0 && t.c == 0 && t.d == 1)
-            {
-                return 10;
-            }
-            if(t.a == 0 && t.b == 0 && t.c == 1 && t.d == 0)
-            {
-                return 11;
-            }
-            if(t.a == 1 && t.b == 0 && t.c == 0 && t.d == 0)
-            {
-                return 12;
-            }
-            if(t.a == 1 && t.b == 1 && t.c == 1 && t.d == 1)
-            {
-                return 13;
-            }
-            return 0;
-        };
-
-
-        auto inbounds = [this](uint32_t const x, uint32_t const y) -> bool
-        {
-            if(x >= width_ || y >= height_) return false;
-            return true;
-        };
-        auto gat = [&](uint32_t const x, uint32_t const y) -> uint32_t
-        {
-            if(inbounds(x,y)) return altmap_(x,y);
-            else return 0;
-        };
-
-
-        uint32_t row = 0,col = 0;
-        uint32_t MAX_TILE_HEIGHT = 255;
-        uint32_t current_tile = 0;
-        /* Top and left edge */
-        for (row = 0; row < height_; row++)
-        {
-            for (col = 0; col < width_; col++)
-            {
-                current_tile = MAX_TILE_HEIGHT;
-                if (col != 0)
-                {
-                    /* Find lowest tile; either the top or left one */
-                    current_tile = altmap_(col-1,row); // top edge
-                }
-                if (row != 0)
-                {
-                    if ( altmap_( col,row - 1) < current_tile)
-                    {
-                        current_tile = altmap_(col,row-1); // left edge
-                    }
-                }
-
-                /* Does the height differ more than one? */
-                if (altmap_.at(col, row) >= current_tile + 2) {
-                    /* Then change the height to be no more than one */
-                    altmap_.at(col, row) = current_tile + 1;
-                }
-            }
-        }
-
-        /* Bottom and right edge */
-        for (row = height_ - 1; row < height_; row--)
-        {
-            for (col = width_ - 1; col < width_; col--)
-            {
-                current_tile = MAX_TILE_HEIGHT;
-                if (col != width_ - 1)
-                {
-                    /* Find lowest tile; either the bottom and right one */
-                    current_tile = altmap_.at(col + 1, row); // bottom edge
-                }
-
-                if (row != height_ - 1)
-                {
-                    if (altmap_.at(col, row + 1) < current_tile)
-                    {
-                        current_tile = altmap_.at(col, row + 1); // right edge
-                    }
-                }
-
-                /* Does the height differ more than one? */
-                if (altmap_.at(col, row) >= current_tile + 2)
-                {
-                    /* Then change the height to be no more than one */
-                    altmap_.at(col, row) = current_tile + 1;
-                }
-            }
-        }
-
-
+        solveSlopes(altmap_, MAX_TILE_HEIGHT, threads);
+        classify(threads);
+    }
 
+    //brushes for a terrain that is valid already. each changes the heights of the tiles within radius of (x, y),
+    //moves the tiles around them as far as it takes for the terrain to be valid again and picks the shapes of the
+    //tiles next to any that moved. a raised tile pulls its neighbours up and a lowered one pulls them down, so the
+    //brush is never undone, and the time taken is that of the tiles that move, not that of the map.
+    //they return the tiles whose height or shape changed, for a partial upload
+    auto raise(int32_t const x, int32_t const y, uint32_t const radius, uint8_t const amount = 1) -> Rect
+    {
+        return brush(x, y, radius, [amount](uint8_t const h) { return static_cast<uint8_t>(std::min(h + amount, 255)); });
+    }
 
-        for(uint32_t y = 0; y < height_; ++y)
-        {
-            for(uint32_t x = 0; x < width_; ++x)
-            {
+    auto lower(int32_t const x, int32_t const y, uint32_t const radius, uint8_t const amount = 1) -> Rect
+    {
+        return brush(x, y, radius, [amount](uint8_t const h) { return static_cast<uint8_t>(std::max(h - amount, 0)); });
+    }
 
-                auto const h = altmap_.at(x,y);
-                ter t;
-                //look up left
-                if(gat(x-1,y-1) > h) { t.a = 1; }
-
-                //look up center
-                if(gat(x,y-1) > h) { t.a = 1; t.b = 1; }
-                //loop up right
-                if(gat(x+1,y-1) > h) { t.b = 1; }
-                //left
-                if(gat(x-1,y) > h) { t.a = 1; t.c = 1; }
-                //right
-                if(gat(x+1,y) > h) { t.b = 1; t.d = 1; }
-                //down left
-                if(gat(x-1,y+1) > h) { t.c = 1; }
-                //down center
-                if(gat(x,y+1) > h) { t.c = 1; t.d = 1; }
-                //down right
-                if(gat(x+1,y+1) > h) { t.d = 1; }
-
-                auto const m = selectxter(t);
-                termap_.at(x,y) = m;
-            }
-        }
+    auto flatten(int32_t const x, int32_t const y, uint32_t const radius, uint8_t const level) -> Rect
+    {
+        return brush(x, y, radius, [level](uint8_t) { return level; });
     }
 
 
@@ -267,33 +164,235 @@ public:
         return height_;
     }
 
-    [[nodiscard]] auto termapData() -> uint32_t*
+    [[nodiscard]] auto termapData() -> uint8_t*
     {
         return termap_.data();
     }
 
-    [[nodiscard]] auto altmapData() -> uint32_t*
+    [[nodiscard]] auto altmapData() -> uint8_t*
     {
         return altmap_.data();
     }
 
 
-    auto termap() -> Vector2d<uint32_t>&
+    auto termap() -> Vector2d<uint8_t>&
     {
         return termap_;
     }
 
-    auto altmap() -> Vector2d<uint32_t>&
+    auto altmap() -> Vector2d<uint8_t>&
     {
         return altmap_;
     }
 
 private:
+    //tile shape for the bits a (top left), b (top right), c (bottom left) and d (bottom right) of the corners that
+    //have a higher neighbour, combinations without a shape (two opposite corners) are flat
+    static constexpr std::array<uint8_t, 16> SHAPES = []()
+    {
+        std::array<uint8_t, 16> s{};
+        auto const set = [&s](uint8_t const a, uint8_t const b, uint8_t const c, uint8_t const d, uint8_t const shape)
+        {
+            s[a | (b << 1) | (c << 2) | (d << 3)] = shape;
+        };
+        set(1,1,0,0, 1);
+        set(0,1,0,1, 2);
+        set(0,0,1,1, 3);
+        set(1,0,1,0, 4);
+        set(1,1,0,1, 5);
+        set(0,1,1,1, 6);
+        set(1,0,1,1, 7);
+        set(1,1,1,0, 8);
+        set(0,1,0,0, 9);
+        set(0,0,0,1, 10);
+        set(0,0,1,0, 11);
+        set(1,0,0,0, 12);
+        set(1,1,1,1, 13);
+        return s;
+    }();
+
+    //highest a tile next to the border can be above it, the border counts as this high
+    static constexpr uint32_t MAX_TILE_HEIGHT = 255;
+
     uint32_t width_ = 0;
     uint32_t height_ = 0;
 
-    Vector2d<uint32_t> termap_;
-    Vector2d<uint32_t> altmap_;
+    //a byte a tile, tile shapes are 0 to 13 and heights 0 to 255, the renderer uploads them as they are
+    Vector2d<uint8_t> termap_;
+    Vector2d<uint8_t> altmap_;
+
+    //the file load() opened and which of its tiles are in the maps already
+    std::unique_ptr<TerrainFile> file_;
+    std::vector<bool> loaded_;
+
+    //the tiles from x0, y0 up to x1, y1 that were touched
+    struct Bounds
+    {
+        uint32_t x0 = ~0u, y0 = ~0u, x1 = 0, y1 = 0;
+
+        [[nodiscard]] auto empty() const -> bool { return x1 == 0; }
+
+        auto add(uint32_t const x, uint32_t const y) -> void
+        {
+            x0 = std::min(x0, x);
+            y0 = std::min(y0, y);
+            x1 = std::max(x1, x + 1);
+            y1 = std::max(y1, y + 1);
+        }
+    };
+
+    //scratch for the brushes, the tiles they moved up and down and the tiles left to settle by height
+    std::vector<uint32_t> raised_;
+    std::vector<uint32_t> lowered_;
+    std::array<std::vector<uint32_t>, 256> heights_;
+
+    //applies the brush to the tiles of the disc and settles the tiles around the ones it changed
+    template<class F>
+    auto brush(int32_t const x, int32_t const y, uint32_t const radius, F const & apply) -> Rect
+    {
+        int64_t const r = radius;
+        int64_t const x0 = std::max<int64_t>(x - r, 0);
+        int64_t const y0 = std::max<int64_t>(y - r, 0);
+        int64_t const x1 = std::min<int64_t>(x + r + 1, width_);
+        int64_t const y1 = std::min<int64_t>(y + r + 1, height_);
+
+        raised_.clear();
+        lowered_.clear();
+        Bounds moved;
+        for(int64_t ty = y0; ty < y1; ++ty)
+        {
+            for(int64_t tx = x0; tx < x1; ++tx)
+            {
+                if((tx - x) * (tx - x) + (ty - y) * (ty - y) > r * r) { continue; }
+
+                uint32_t const i = static_cast<uint32_t>(ty * width_ + tx);
+                uint8_t& h = altmap_.data()[i];
+                uint8_t const next = apply(h);
+                if(next == h) { continue; }
+
+                (next > h ? raised_ : lowered_).push_back(i);
+                h = next;
+                moved.add(tx, ty);
+            }
+        }
+
+        settle(raised_, true, moved);
+        settle(lowered_, false, moved);
+        if(moved.empty()) { return {}; }
+
+        //a shape depends on the eight neighbours, so the tiles next to the ones that moved are picked again too
+        uint32_t const cx0 = moved.x0 > 0 ? moved.x0 - 1 : 0;
+        uint32_t const cy0 = moved.y0 > 0 ? moved.y0 - 1 : 0;
+        uint32_t const cx1 = std::min(moved.x1 + 1, width_);
+        uint32_t const cy1 = std::min(moved.y1 + 1, height_);
+        classifyRect(cx0, cx1, cy0, cy1);
+        return {cx0, cy0, cx1 - cx0, cy1 - cy0};
+    }
+
+    //moves the neighbours of the seeds, which were all raised (up) or all lowered, until no tile is more than one
+    //above a neighbour, the way makeValid() would if it were allowed to raise. the tiles are settled in the order
+    //of their heights, highest first going up and lowest first going down, a bucket a height, so a tile is final
+    //the first time it is settled and moves at most once, an entry for a height the tile has left is skipped
+    auto settle(std::vector<uint32_t> const & seeds, bool const up, Bounds& moved) -> void
+    {
+        if(seeds.empty()) { return; }
+
+        for(auto& bucket : heights_) { bucket.clear(); }
+        uint8_t* const alts = altmap_.data();
+        for(uint32_t const i : seeds) { heights_[alts[i]].push_back(i); }
+
+        size_t const width = width_;
+        size_t const height = height_;
+        for(int h = up ? 255 : 0; up ? h > 0 : h < 255; h += up ? -1 : 1)
+        {
+            int const next = up ? h - 1 : h + 1;
+            auto& bucket = heights_[h];
+            for(size_t k = 0; k < bucket.size(); ++k)
+            {
+                uint32_t const i = bucket[k];
+                if(alts[i] != h) { continue; }
+
+                size_t const x = i % width;
+                size_t const y = i / width;
+                auto const pull = [&](size_t const n)
+                {
+                    if(up ? alts[n] >= next : alts[n] <= next) { return; }
+                    alts[n] = static_cast<uint8_t>(next);
+                    heights_[next].push_back(static_cast<uint32_t>(n));
+                    moved.add(static_cast<uint32_t>(n % width), static_cast<uint32_t>(n / width));
+                };
+                if(x > 0) { pull(i - 1); }
+                if(x + 1 < width) { pull(i + 1); }
+                if(y > 0) { pull(i - width); }
+                if(y + 1 < height) { pull(i + width); }
+            }
+        }
+    }
+
+    //rows are independent once the heights are final, so they are dealt out to threads in bands
+    void classify(uint32_t threads)
+    {
+        if(width_ == 0 || height_ == 0) { return; }
+
+        if(threads == 0) { threads = std::thread::hardware_concurrency(); }
+        threads = std::clamp<uint32_t>(threads, 1, (height_ + 63) / 64);
+
+        std::vector<std::jthread> pool;
+        uint32_t const band = (height_ + threads - 1) / threads;
+        for(uint32_t t = 1; t < threads; ++t)
+        {
+            pool.emplace_back([this, t, band] { classifyRect(0, width_, t * band, std::min(height_, (t + 1) * band)); });
+        }
+        classifyRect(0, width_, 0, std::min(height_, band));
+    }
+
+    //the rows above, at and below the current one are kept with a tile more on either side, so no neighbour
+    //needs a bounds check. tiles outside of the map count as 0, which is never higher than a tile
+    void classifyRect(uint32_t const x0, uint32_t const x1, uint32_t const y0, uint32_t const y1)
+    {
+        //a local width, stores through bytes could change width_ as far as the compiler knows
+        size_t const width = x1 - x0;
+        size_t const stride = width + 2;
+        std::vector<uint8_t> rows(3 * stride, 0);
+        std::vector<uint8_t> corners(width);
+
+        //row tile k is map tile x0 - 1 + k
+        size_t const from = x0 > 0 ? x0 - 1 : 0;
+        size_t const to = std::min(x1 + 1, width_);
+        auto const load = [&](uint8_t* const dst, int64_t const y)
+        {
+            if(y < 0 || y >= height_) { std::fill_n(dst, stride, 0); return; }
+            dst[0] = 0;
+            dst[stride - 1] = 0;
+            std::copy(&altmap_(from, y), &altmap_(to - 1, y) + 1, dst + (from + 1 - x0));
+        };
+
+        uint8_t* up = rows.data();
+        uint8_t* mid = up + stride;
+        uint8_t* down = mid + stride;
+        load(up, int64_t(y0) - 1);
+        load(mid, y0);
+        for(uint32_t y = y0; y < y1; ++y)
+        {
+            load(down, int64_t(y) + 1);
+            for(size_t x = 0; x < width; ++x)
+            {
+                //a corner has a higher neighbour when the highest of the three tiles around it is
+                uint8_t const h = mid[x + 1];
+                uint8_t const a = std::max({up[x], up[x + 1], mid[x]});
+                uint8_t const b = std::max({up[x + 1], up[x + 2], mid[x + 2]});
+                uint8_t const c = std::max({mid[x], down[x], down[x + 1]});
+                uint8_t const d = std::max({mid[x + 2], down[x + 1], down[x + 2]});
+                corners[x] = (a > h ? 1 : 0) | (b > h ? 2 : 0) | (c > h ? 4 : 0) | (d > h ? 8 : 0);
+            }
+
+            uint8_t* const out = &termap_(x0, y);
+            for(size_t x = 0; x < width; ++x) { out[x] = SHAPES[corners[x]]; }
+
+            std::swap(up, mid);
+            std::swap(mid, down);
+        }
+    }
 
 
 };
@@ -0,0 +1,144 @@
+#pragma once
+
+#include "util/array2d.hpp"
+#include "util/mapped_file.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace vkopter::game
+{
+
+//a valid terrain on disk, heights and tile types a byte each, cut into square tiles of TILE x TILE:
+//  Header, padded to DATA_OFFSET
+//  the tiles in row major order, each TILE * TILE heights followed by TILE * TILE tile types, the parts of the
+//  tiles on the right and bottom edge that are outside of the map are 0
+//every tile is at a fixed offset and starts on a page, so a tile is found without a table, is read straight out
+//of the mapping and only the pages of the tiles that get touched are ever read from disk.
+//the terrain is stored after makeValid(), which needs the whole map, so loading a tile is just a copy
+class TerrainFile
+{
+public:
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t TILE_BITS = 6;
+    static constexpr uint32_t TILE = 1u << TILE_BITS;
+    static constexpr size_t TILE_CELLS = size_t(TILE) * TILE;
+    static constexpr size_t TILE_BYTES = 2 * TILE_CELLS;
+    static constexpr size_t DATA_OFFSET = 4096;
+
+    explicit TerrainFile(std::string const & filename) :
+        file_(filename)
+    {
+        if(file_.size() < sizeof(Header)) { throw std::runtime_error("terrain file is truncated!"); }
+        std::memcpy(&header_, file_.data(), sizeof(Header));
+
+        if(header_.magic != MAGIC || header_.version != VERSION) { throw std::runtime_error("not a terrain file!"); }
+        if(header_.tileBits != TILE_BITS) { throw std::runtime_error("terrain file was written with another tile size!"); }
+        if(file_.size() < DATA_OFFSET + static_cast<uint64_t>(tilesX()) * tilesY() * TILE_BYTES)
+        {
+            throw std::runtime_error("terrain file is truncated!");
+        }
+    }
+
+    [[nodiscard]] auto width() const -> uint32_t { return header_.width; }
+    [[nodiscard]] auto height() const -> uint32_t { return header_.height; }
+    [[nodiscard]] auto tilesX() const -> uint32_t { return (header_.width + TILE - 1) >> TILE_BITS; }
+    [[nodiscard]] auto tilesY() const -> uint32_t { return (header_.height + TILE - 1) >> TILE_BITS; }
+
+    //TILE * TILE heights of tile (tx, ty), row major
+    [[nodiscard]] auto altitudes(uint32_t const tx, uint32_t const ty) const -> uint8_t const *
+    {
+        return reinterpret_cast<uint8_t const *>(file_.data() + DATA_OFFSET + (static_cast<size_t>(ty) * tilesX() + tx) * TILE_BYTES);
+    }
+
+    //TILE * TILE tile types of tile (tx, ty), row major
+    [[nodiscard]] auto types(uint32_t const tx, uint32_t const ty) const -> uint8_t const *
+    {
+        return altitudes(tx, ty) + TILE_CELLS;
+    }
+
+    //copies tile (tx, ty) into maps of the size of the file
+    template<class T>
+    auto loadTile(uint32_t const tx, uint32_t const ty, Vector2d<T> & altmap, Vector2d<T> & termap) const -> void
+    {
+        uint8_t const * const alts = altitudes(tx, ty);
+        uint8_t const * const ters = types(tx, ty);
+        uint32_t const x0 = tx << TILE_BITS;
+        uint32_t const y0 = ty << TILE_BITS;
+        uint32_t const w = std::min(TILE, header_.width - x0);
+        uint32_t const h = std::min(TILE, header_.height - y0);
+        for(uint32_t y = 0; y < h; ++y)
+        {
+            std::copy_n(alts + y * TILE, w, &altmap(x0, y0 + y));
+            std::copy_n(ters + y * TILE, w, &termap(x0, y0 + y));
+        }
+    }
+
+    //heights above 255 do not fit a byte and are stored as 255
+    template<class T>
+    static auto save(std::string const & filename, Vector2d<T> & altmap, Vector2d<T> & termap) -> void
+    {
+        Header header{};
+        header.magic = MAGIC;
+        header.version = VERSION;
+        header.tileBits = TILE_BITS;
+        header.width = static_cast<uint32_t>(altmap.getWidth());
+        header.height = static_cast<uint32_t>(altmap.getHeight());
+
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+        if(!file.is_open()) { throw std::runtime_error("failed to open file!"); }
+
+        std::vector<char> page(DATA_OFFSET, 0);
+        std::memcpy(page.data(), &header, sizeof(header));
+        file.write(page.data(), static_cast<std::streamsize>(page.size()));
+
+        std::vector<uint8_t> tile(TILE_BYTES);
+        for(uint32_t y0 = 0; y0 < header.height; y0 += TILE)
+        {
+            for(uint32_t x0 = 0; x0 < header.width; x0 += TILE)
+            {
+                std::fill(tile.begin(), tile.end(), 0);
+                uint32_t const w = std::min(TILE, header.width - x0);
+                uint32_t const h = std::min(TILE, header.height - y0);
+                for(uint32_t y = 0; y < h; ++y)
+                {
+                    for(uint32_t x = 0; x < w; ++x)
+                    {
+                        tile[y * TILE + x] = static_cast<uint8_t>(std::min<uint32_t>(altmap(x0 + x, y0 + y), 255));
+                        tile[TILE_CELLS + y * TILE + x] = static_cast<uint8_t>(termap(x0 + x, y0 + y));
+                    }
+                }
+                file.write(reinterpret_cast<char const *>(tile.data()), static_cast<std::streamsize>(tile.size()));
+            }
+        }
+        if(!file) { throw std::runtime_error("failed to write terrain file!"); }
+    }
+
+private:
+    static constexpr std::array<char, 8> MAGIC = {'V', 'K', 'T', 'E', 'R', 'R', '\0', '\0'};
+
+    struct Header
+    {
+        std::array<char, 8> magic;
+        uint32_t version;
+        uint32_t tileBits;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    static_assert(sizeof(Header) == 24, "the layout is part of the file format");
+    static_assert(std::endian::native == std::endian::little, "the header is read in place");
+
+    MappedFile file_;
+    Header header_;
+};
+
+}
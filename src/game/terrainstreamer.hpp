@@ -0,0 +1,204 @@
+#pragma once
+
+#include "terrainfile.hpp"
+#include "util/triple_buffer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace vkopter::game
+{
+
+//pages the chunks of a terrain file around a point of focus, usually the camera, in and out on its own thread, so
+//maps far bigger than the gpu buffers can be flown over with a fixed amount of memory.
+//the resident chunks are a window of RING x RING chunks around the focus. chunk (cx, cy) always goes to slot
+//(cx % RING, cy % RING), so a window that moves only replaces the chunks that left it, in the slots they leave
+//behind, and the gpu buffers, laid out by slot, never have to move anything. the worker reads the chunks
+//straight out of the mapped file, which is where the disk is read, and hands them to one consumer, usually the
+//render thread, through a TripleBuffer the same way CityWorker hands over grid deltas
+class TerrainStreamer
+{
+public:
+    static constexpr uint32_t CHUNK = TerrainFile::TILE;
+    static constexpr size_t CHUNK_CELLS = TerrainFile::TILE_CELLS;
+    static constexpr uint32_t RING = 4;
+    static constexpr uint32_t SLOTS = RING * RING;
+    static constexpr uint32_t WINDOW = RING * CHUNK;
+
+    static_assert(SLOTS <= 32, "residentMask() has a bit per slot");
+
+    //ticks the worker looks for a window that moved at
+    static constexpr std::chrono::microseconds TICK{2000};
+
+    struct Chunk
+    {
+        int32_t cx, cy;
+        uint32_t slot;
+        std::array<uint8_t, CHUNK_CELLS> alts;
+        std::array<uint8_t, CHUNK_CELLS> ters;
+    };
+
+    //the chunks paged in since the last delta, at most one per slot
+    using Delta = std::vector<Chunk>;
+
+    explicit TerrainStreamer(std::string const & path) :
+        file_(path)
+    {
+        paged_.fill(NONE);
+        resident_.fill(NONE);
+        focus_.store(pack(window_), std::memory_order_relaxed);
+    }
+
+    TerrainStreamer(TerrainStreamer const &) = delete;
+    auto operator=(TerrainStreamer const &) -> TerrainStreamer& = delete;
+
+    ~TerrainStreamer()
+    {
+        stop();
+    }
+
+    [[nodiscard]] auto width() const -> uint32_t { return file_.width(); }
+    [[nodiscard]] auto height() const -> uint32_t { return file_.height(); }
+
+    auto start() -> void
+    {
+        if(worker_.joinable()) { return; }
+        worker_ = std::jthread([this](std::stop_token const st) { run(st); });
+    }
+
+    auto stop() -> void
+    {
+        if(!worker_.joinable()) { return; }
+        worker_.request_stop();
+        worker_.join();
+    }
+
+    //consumer side: moves the window to be centred on (x, y) in tiles, as far as the map allows
+    auto focus(float const x, float const y) -> void
+    {
+        auto const origin = [](float const p, uint32_t const chunks) -> int32_t
+        {
+            auto const c = static_cast<int32_t>(std::floor(p / CHUNK + 0.5f)) - static_cast<int32_t>(RING / 2);
+            return std::clamp<int32_t>(c, 0, std::max<int32_t>(static_cast<int32_t>(chunks) - RING, 0));
+        };
+        window_ = {origin(x, file_.tilesX()), origin(y, file_.tilesY())};
+        focus_.store(pack(window_), std::memory_order_relaxed);
+    }
+
+    //consumer side: the newest delta or nullptr when nothing was paged in, valid until the next call
+    auto latest() -> Delta const *
+    {
+        //without a worker running the paging happens here
+        if(!worker_.joinable()) { page(window_); }
+        if(!buffer_.update()) { return nullptr; }
+
+        for(auto const & c : buffer_.front()) { resident_[c.slot] = key(c.cx, c.cy); }
+        return &buffer_.front();
+    }
+
+    //consumer side: the first chunk of the window
+    [[nodiscard]] auto windowX() const -> uint32_t { return window_.cx; }
+    [[nodiscard]] auto windowY() const -> uint32_t { return window_.cy; }
+
+    //consumer side: bit s set when slot s holds the chunk the window wants there, slots that are waiting for
+    //their chunk still hold the one that left and must not be drawn
+    [[nodiscard]] auto residentMask() const -> uint32_t
+    {
+        uint32_t mask = 0;
+        for(uint32_t s = 0; s < SLOTS; ++s)
+        {
+            auto const [cx, cy] = chunkIn(window_, s);
+            if(resident_[s] == key(cx, cy)) { mask |= 1u << s; }
+        }
+        return mask;
+    }
+
+private:
+    struct Window
+    {
+        int32_t cx = 0, cy = 0;
+    };
+
+    static constexpr uint64_t NONE = ~uint64_t(0);
+
+    TerrainFile file_;
+    Window window_;                               //only touched by the consumer
+    std::array<uint64_t, SLOTS> resident_;        //what the consumer has in every slot
+    std::array<uint64_t, SLOTS> paged_;           //what the worker has handed over for every slot
+    std::atomic<uint64_t> focus_;
+    TripleBuffer<Delta> buffer_;
+    std::jthread worker_;
+
+    [[nodiscard]] static auto key(int32_t const cx, int32_t const cy) -> uint64_t
+    {
+        return static_cast<uint64_t>(static_cast<uint32_t>(cx)) << 32 | static_cast<uint32_t>(cy);
+    }
+
+    [[nodiscard]] static auto pack(Window const w) -> uint64_t { return key(w.cx, w.cy); }
+    [[nodiscard]] static auto unpack(uint64_t const k) -> Window
+    {
+        return {static_cast<int32_t>(k >> 32), static_cast<int32_t>(k & 0xffffffffu)};
+    }
+
+    //the one chunk of the window that maps to slot s
+    [[nodiscard]] static auto chunkIn(Window const w, uint32_t const s) -> std::array<int32_t, 2>
+    {
+        constexpr int32_t R = RING;
+        int32_t const sx = static_cast<int32_t>(s) % R;
+        int32_t const sy = static_cast<int32_t>(s) / R;
+        return {w.cx + (sx - w.cx % R + R) % R, w.cy + (sy - w.cy % R + R) % R};
+    }
+
+    auto run(std::stop_token const st) -> void
+    {
+        while(!st.stop_requested())
+        {
+            auto const now = std::chrono::steady_clock::now();
+            page(unpack(focus_.load(std::memory_order_relaxed)));
+            std::this_thread::sleep_until(now + TICK);
+        }
+    }
+
+    //reads the chunks of the window that were not handed over yet into the back delta and tries to publish it.
+    //a chunk for a slot that already has one waiting in the delta replaces it
+    auto page(Window const w) -> void
+    {
+        Delta& d = buffer_.back();
+        for(uint32_t s = 0; s < SLOTS; ++s)
+        {
+            auto const [cx, cy] = chunkIn(w, s);
+            if(paged_[s] == key(cx, cy) || cx >= static_cast<int32_t>(file_.tilesX()) || cy >= static_cast<int32_t>(file_.tilesY()))
+            {
+                continue;
+            }
+
+            auto c = std::find_if(d.begin(), d.end(), [s](Chunk const & e) { return e.slot == s; });
+            if(c == d.end())
+            {
+                d.reserve(SLOTS);
+                c = d.emplace(d.end());
+            }
+            c->cx = cx;
+            c->cy = cy;
+            c->slot = s;
+            std::copy_n(file_.altitudes(cx, cy), CHUNK_CELLS, c->alts.begin());
+            std::copy_n(file_.types(cx, cy), CHUNK_CELLS, c->ters.begin());
+            paged_[s] = key(cx, cy);
+        }
+
+        if(!d.empty() && buffer_.tryPublish())
+        {
+            buffer_.back().clear();
+        }
+    }
+};
+
+}
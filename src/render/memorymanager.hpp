@@ -2,9 +2,16 @@
 
 #include <vulkan/vulkan.hpp>
 #include "vk_mem_alloc.h"
+#include "util/slot_table.hpp"
 
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
 #include <utility>
-#include <map>
+#include <span>
+#include <tuple>
+#include <vector>
 
 namespace vkopter::render
 {
@@ -12,21 +19,25 @@ namespace vkopter::render
 class MemoryManager
 {
 public:
-    MemoryManager(vk::Instance inst, vk::Device dev, vk::PhysicalDevice pdev, uint32_t queueFamilyIndex) :
+    //uploads run on the queue of transferQueueFamilyIndex, a dedicated transfer queue where the device has one, so
+    //they overlap with rendering, and what they write is used on the queue of graphicsQueueFamilyIndex
+    MemoryManager(vk::Instance inst, vk::Device dev, vk::PhysicalDevice pdev, uint32_t graphicsQueueFamilyIndex, uint32_t transferQueueFamilyIndex) :
         instance_(inst),
         device_(dev),
-        physical_device_(pdev)
+        physical_device_(pdev),
+        families_{graphicsQueueFamilyIndex, transferQueueFamilyIndex}
     {
         vk::CommandPoolCreateInfo cpci;
         cpci.setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer);
-        cpci.setQueueFamilyIndex(queueFamilyIndex);
+        cpci.setQueueFamilyIndex(transferQueueFamilyIndex);
         transfer_pool_ = dev.createCommandPool(cpci);
 
-        vk::CommandBufferAllocateInfo cbai;
-        cbai.setCommandBufferCount(1);
-        cbai.setCommandPool(transfer_pool_);
-        cbai.setLevel(vk::CommandBufferLevel::ePrimary);
-        transfer_command_buffer_ = device_.allocateCommandBuffers(cbai)[0];
+        vk::SemaphoreTypeCreateInfo stci;
+        stci.setSemaphoreType(vk::SemaphoreType::eTimeline);
+        stci.setInitialValue(0);
+        vk::SemaphoreCreateInfo sci;
+        sci.setPNext(&stci);
+        uploads_ = device_.createSemaphore(sci);
 
 
         VmaAllocatorCreateInfo aci = {};
@@ -35,7 +46,9 @@ public:
         aci.instance = inst;
         aci.vulkanApiVersion = VK_API_VERSION_1_0;
         vmaCreateAllocator(&aci, &allocator_);
-        transfer_queue_ = device_.getQueue(queueFamilyIndex,0);
+        transfer_queue_ = device_.getQueue(transferQueueFamilyIndex,0);
+
+        create_staging();
     }
 
     ~MemoryManager()
@@ -49,10 +62,16 @@ public:
             std::abort();
         }
 
-        for(auto& b : buffers_)
+        for(auto const & b : buffers_)
+        {
+            vmaDestroyBuffer(allocator_, b.buffer, b.allocation);
+        }
+        for(auto const & i : images_)
         {
-            destroyBuffer(b.first);
+            vmaDestroyImage(allocator_, i.image, i.allocation);
         }
+        destroy_staging();
+        device_.destroySemaphore(uploads_);
         device_.destroyCommandPool(transfer_pool_);
 
 
@@ -67,7 +86,65 @@ public:
     auto operator = (MemoryManager&) -> MemoryManager& = delete;
     auto operator = (MemoryManager&&) -> MemoryManager& = delete;
 
-    auto createBuffer(vk::BufferUsageFlags const usage, std::size_t const sizeInBytes, void* data = nullptr) -> vk::Buffer
+    //where a buffer lives. device buffers are written through the staging ring and a copy on the transfer queue.
+    //host buffers stay mapped and every update is a memcpy straight into memory the device reads, no staging and
+    //no copy: device local and host visible memory where the device has it (resizable bar), host memory where it
+    //does not. they are for the small buffers rewritten every frame, one per frame in flight so the frame that
+    //reads one is done before it is written again
+    enum class BufferMemory
+    {
+        device,
+        host
+    };
+
+    //what createBuffer() and createImage() hand out: the vulkan handle, which they stand in for, and the slot of
+    //the allocation behind it. slots are generation checked, a handle that outlived its buffer finds nothing
+    struct Buffer
+    {
+        vk::Buffer buffer;
+        SlotHandle slot;
+
+        operator vk::Buffer() const { return buffer; }
+    };
+
+    struct Image
+    {
+        vk::Image image;
+        SlotHandle slot;
+
+        operator vk::Image() const { return image; }
+    };
+
+    //what memory goes to, for the accounting
+    enum class MemoryUse
+    {
+        deviceBuffers,
+        hostBuffers,
+        images,
+        staging,
+        count
+    };
+
+    static constexpr size_t MEMORY_USES = static_cast<size_t>(MemoryUse::count);
+
+    struct MemoryStats
+    {
+        std::array<vk::DeviceSize, MEMORY_USES> bytes{};     //in use now, by MemoryUse
+        std::array<vk::DeviceSize, MEMORY_USES> peak{};      //the most ever in use at once
+        vk::DeviceSize blockBytes = 0;                       //taken from vulkan
+        vk::DeviceSize allocationBytes = 0;                  //of that handed out
+        vk::DeviceSize deviceUsage = 0;                      //of the device local heaps, by this process
+        vk::DeviceSize deviceBudget = 0;                     //of the device local heaps, what the driver offers
+
+        //the part of what was taken from vulkan that sits unused between allocations
+        [[nodiscard]] auto fragmentation() const -> double
+        {
+            return blockBytes == 0 ? 0.0 : 1.0 - static_cast<double>(allocationBytes) / static_cast<double>(blockBytes);
+        }
+    };
+
+    auto createBuffer(vk::BufferUsageFlags const usage, std::size_t const sizeInBytes, void* data = nullptr,
+                      BufferMemory const memory = BufferMemory::device) -> Buffer
     {
 
         VkBuffer buffer = {};
@@ -76,72 +153,214 @@ public:
         VmaAllocationCreateInfo bufferAllocationCreateInfo = {};
         bufferAllocationCreateInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
         bufferAllocationCreateInfo.flags = VMA_ALLOCATION_CREATE_STRATEGY_MIN_MEMORY_BIT;
+        if(memory == BufferMemory::host)
+        {
+            bufferAllocationCreateInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+        }
         VkBufferCreateInfo bufferCreateInfo = {};
         bufferCreateInfo.pNext = nullptr;
         bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
         bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | (VkBufferUsageFlags)usage;
         bufferCreateInfo.size = sizeInBytes;
+
+        //buffers are written in parts by the transfer queue and read by the graphics queue every frame, handing
+        //them over both ways would cost a round trip between the queues a frame, so both families share them
+        if(families_[0] != families_[1])
+        {
+            bufferCreateInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+            bufferCreateInfo.queueFamilyIndexCount = static_cast<uint32_t>(families_.size());
+            bufferCreateInfo.pQueueFamilyIndices = families_.data();
+        }
         vmaCreateBuffer(allocator_, &bufferCreateInfo, &bufferAllocationCreateInfo, &buffer, &bufferAllocation,&bufferAllocationInfo);
 
-        buffers_.insert({buffer,{bufferAllocation,bufferAllocationInfo}});
+        MemoryUse const use = memory == BufferMemory::host ? MemoryUse::hostBuffers : MemoryUse::deviceBuffers;
+        account(use, bufferAllocationInfo.size, true);
+        Buffer const b{buffer, buffers_.insert({buffer, bufferAllocation, bufferAllocationInfo, use})};
 
         if(data)
         {
-            updateBuffer(buffer, 0, sizeInBytes, data);
+            updateBuffer(b, 0, sizeInBytes, data);
         }
 
-        return buffer;
+        return b;
+    }
+
+    //where a host buffer is mapped, to build its contents in place, nullptr for a device buffer. what is written
+    //there goes to the device with flushMapped()
+    [[nodiscard]] auto mapped(Buffer const & buffer) const -> void*
+    {
+        return allocation_of(buffer).info.pMappedData;
+    }
+
+    //makes size bytes at offset in a host buffer, written through mapped(), visible to the device
+    auto flushMapped(Buffer const & buffer, vk::DeviceSize const offset, vk::DeviceSize const sizeInBytes) -> void
+    {
+        vmaFlushAllocation(allocator_, allocation_of(buffer).allocation, offset, sizeInBytes);
     }
 
-    auto updateBuffer(vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize const sizeInBytes, void* data) -> void
+    //copies size bytes of data to offset in buffer. a host buffer is written right away, for a device buffer the
+    //data goes into the staging ring right away and the copy into the batch, which goes to the transfer queue with
+    //the next flush()
+    auto updateBuffer(Buffer const & buffer, vk::DeviceSize offset, vk::DeviceSize const sizeInBytes, void const * data) -> void
     {
         if(data == nullptr || sizeInBytes == 0) { return; }
+        if(write_mapped(buffer, offset, sizeInBytes, data)) { return; }
 
-        VkBuffer stagingbuffer = {};
-        VmaAllocation stagingbufferAllocation = {};
-        VmaAllocationInfo stagingbufferAllocationInfo = {};
-        VmaAllocationCreateInfo stagingbufferAllocationCreateInfo = {};
-        stagingbufferAllocationCreateInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
-        stagingbufferAllocationCreateInfo.flags = VMA_ALLOCATION_CREATE_STRATEGY_MIN_TIME_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
-        VkBufferCreateInfo stagingbufferCreateInfo = {};
-        stagingbufferCreateInfo.pNext = nullptr;
-        stagingbufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        stagingbufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-        stagingbufferCreateInfo.size = sizeInBytes;
-        vmaCreateBuffer(allocator_, &stagingbufferCreateInfo, &stagingbufferAllocationCreateInfo, &stagingbuffer, &stagingbufferAllocation,&stagingbufferAllocationInfo);
+        auto const [staging, from] = stage(data, sizeInBytes);
+        vk::BufferCopy const region{from, offset, sizeInBytes};
+        copy(staging, buffer, std::span(&region, 1));
+    }
 
-        void* memory = nullptr;
+    //size bytes of data staged once and the regions of it copied to every buffer, srcOffset of a region is into
+    //data, dstOffset into the buffers. batched like updateBuffer()
+    auto updateBufferRegions(std::span<Buffer const> buffers, std::span<vk::BufferCopy const> regions,
+                             vk::DeviceSize const sizeInBytes, void const * data) -> void
+    {
+        if(data == nullptr || sizeInBytes == 0 || regions.empty() || buffers.empty()) { return; }
 
-        vmaInvalidateAllocation(allocator_, stagingbufferAllocation, offset, sizeInBytes);
-        vmaMapMemory(allocator_, stagingbufferAllocation, &memory);
-        std::memcpy(static_cast<char*>(memory)+offset, data, sizeInBytes);
-        vmaUnmapMemory(allocator_, stagingbufferAllocation);
-        vmaFlushAllocation(allocator_, stagingbufferAllocation, offset, sizeInBytes);
+        bool staged = false;
+        vk::Buffer staging;
+        for(auto const & b : buffers)
+        {
+            if(mapped(b) != nullptr)
+            {
+                for(auto const & r : regions) { write_mapped(b, r.dstOffset, r.size, static_cast<char const *>(data) + r.srcOffset); }
+                continue;
+            }
+
+            if(!staged)
+            {
+                vk::DeviceSize from = 0;
+                std::tie(staging, from) = stage(data, sizeInBytes);
+                staged_regions_.assign(regions.begin(), regions.end());
+                for(auto& r : staged_regions_) { r.srcOffset += from; }
+                staged = true;
+            }
+            copy(staging, b, staged_regions_);
+        }
+    }
+
+    //a part of an update: size bytes of data to offset in buffer
+    struct Region
+    {
+        Buffer buffer;
+        vk::DeviceSize offset = 0;
+        vk::DeviceSize size = 0;
+        void const * data = nullptr;
+    };
+
+    //many updates of any number of buffers at once: the regions of host buffers are written right away, the data
+    //of the others is packed one after the other into the staging ring and every buffer gets one copy command with
+    //a copy region per update of it, in the order of the regions. the renderer uses this for everything it
+    //rewrites every frame
+    auto updateBuffers(std::span<Region const> regions) -> void
+    {
+        vk::DeviceSize total = 0;
+        for(auto const & r : regions)
+        {
+            if(r.data == nullptr || r.size == 0 || write_mapped(r.buffer, r.offset, r.size, r.data)) { continue; }
+            total += r.size;
+        }
+        if(total == 0) { return; }
 
+        Staged const staged = reserve(total);
 
-        vk::CommandBufferBeginInfo cbbi;
-        cbbi.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
-        transfer_command_buffer_.begin(cbbi);
-        transfer_command_buffer_.copyBuffer(stagingbuffer, buffer, vk::BufferCopy{0,offset,sizeInBytes});
-        transfer_command_buffer_.end();
+        //the copies grouped by buffer, a stable sort keeps the updates of a buffer in order
+        staged_copies_.clear();
+        vk::DeviceSize at = 0;
+        for(auto const & r : regions)
+        {
+            if(r.data == nullptr || r.size == 0 || mapped(r.buffer) != nullptr) { continue; }
+            write(staged, at, r.data, r.size);
+            staged_copies_.push_back({r.buffer, vk::BufferCopy{staged.offset + at, r.offset, r.size}});
+            at += r.size;
+        }
+        std::stable_sort(staged_copies_.begin(), staged_copies_.end(), [](auto const & l, auto const & r)
+        {
+            return VkBuffer(l.first.buffer) < VkBuffer(r.first.buffer);
+        });
+
+        for(size_t first = 0; first < staged_copies_.size();)
+        {
+            size_t last = first;
+            staged_regions_.clear();
+            for(; last < staged_copies_.size() && staged_copies_[last].first.buffer == staged_copies_[first].first.buffer; ++last)
+            {
+                staged_regions_.push_back(staged_copies_[last].second);
+            }
+            copy(staged.buffer, staged_copies_[first].first, staged_regions_);
+            first = last;
+        }
+    }
 
+    //submits the batch of uploads since the last flush to the transfer queue, as one command buffer, and returns
+    //its ticket: the value the upload semaphore reaches once the batch is done. the batch is not ordered against
+    //the graphics queue, so it must only write buffers no frame still reads. the renderer calls it once a frame
+    //after beginFrame() and writes only the copies of the current frame, buffers every frame has a copy of get
+    //an update as each frame comes around. then acquire(), and the frame waits for ticket()
+    auto flush() -> uint64_t
+    {
+        StagingFrame& f = staging_frames_[staging_frame_];
+        if(!f.recording) { return ticket_; }
+
+        f.commands.end();
+        f.recording = false;
+        f.ticket = ++ticket_;
+
+        vk::TimelineSemaphoreSubmitInfo tssi;
+        tssi.setSignalSemaphoreValues(f.ticket);
         vk::SubmitInfo si;
-        si.setCommandBuffers(transfer_command_buffer_);
+        si.setCommandBuffers(f.commands);
+        si.setSignalSemaphores(uploads_);
+        si.setPNext(&tssi);
         transfer_queue_.submit(si);
-        transfer_queue_.waitIdle();
 
+        written_.clear();
+        acquires_.insert(acquires_.end(), releases_.begin(), releases_.end());
+        releases_.clear();
+        staging_frame_ = (staging_frame_ + 1) % STAGING_FRAMES;
+        return ticket_;
+    }
+
+    //records into a graphics command buffer what has to happen before the uploads flushed so far are used: the
+    //images the transfer queue released are taken over. the command buffer has to wait for ticket() when it is
+    //submitted, which also makes the copies visible
+    auto acquire(vk::CommandBuffer commands) -> void
+    {
+        if(acquires_.empty()) { return; }
+        commands.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eFragmentShader, {}, {}, {}, acquires_);
+        acquires_.clear();
+    }
+
+    //a timeline semaphore, it reaches the ticket of a batch once the batch is done
+    [[nodiscard]] auto uploadSemaphore() const -> vk::Semaphore
+    {
+        return uploads_;
+    }
 
-        vmaDestroyBuffer(allocator_,stagingbuffer, stagingbufferAllocation);
+    //the ticket of the last batch flushed
+    [[nodiscard]] auto ticket() const -> uint64_t
+    {
+        return ticket_;
+    }
 
+    [[nodiscard]] auto done(uint64_t const ticket) const -> bool
+    {
+        return device_.getSemaphoreCounterValue(uploads_) >= ticket;
     }
 
-    auto destroyBuffer(vk::Buffer buffer) -> void
+    //does nothing for a buffer destroyed already
+    auto destroyBuffer(Buffer const & buffer) -> void
     {
-        vmaDestroyBuffer(allocator_, buffer, buffers_[buffer].first);
-        buffers_.erase(buffer);
+        BufferAllocation const * const a = buffers_.get(buffer.slot);
+        if(a == nullptr) { return; }
+
+        account(a->use, a->info.size, false);
+        vmaDestroyBuffer(allocator_, a->buffer, a->allocation);
+        buffers_.erase(buffer.slot);
     }
 
-    auto createImage(uint32_t width, uint32_t height, vk::Format format, vk::ImageUsageFlags usage, void* data = nullptr) -> vk::Image
+    auto createImage(uint32_t width, uint32_t height, vk::Format format, vk::ImageUsageFlags usage, void* data = nullptr) -> Image
     {
         VkImage img = VK_NULL_HANDLE;
         VkImageCreateInfo ici = {};
@@ -171,45 +390,19 @@ public:
 
 
         auto r = vmaCreateImage(allocator_, &ici, &imageAllocationCreateInfo, &img, &imageAllocation, &imageAllocationInfo);
-        images_.insert({img,{imageAllocation,imageAllocationInfo}});
+        account(MemoryUse::images, imageAllocationInfo.size, true);
+        Image const image{img, images_.insert({img, imageAllocation, imageAllocationInfo})};
 
 
 
+        //the pixels go up with the next batch, on the transfer queue, which hands the image over to the graphics
+        //queue in its final layout. the graphics queue takes it over in acquire()
         if(data)
         {
-            int offset = 0;
-            int sizeInBytes = width * height * 4;
-
-
-            //create staging buufer with pixel data inside
-            VkBuffer stagingbuffer = {};
-            VmaAllocation stagingbufferAllocation = {};
-            VmaAllocationInfo stagingbufferAllocationInfo = {};
-            VmaAllocationCreateInfo stagingbufferAllocationCreateInfo = {};
-            stagingbufferAllocationCreateInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
-            stagingbufferAllocationCreateInfo.flags = VMA_ALLOCATION_CREATE_STRATEGY_MIN_TIME_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
-            VkBufferCreateInfo stagingbufferCreateInfo = {};
-            stagingbufferCreateInfo.pNext = nullptr;
-            stagingbufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-            stagingbufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-            stagingbufferCreateInfo.size = sizeInBytes;
-            vmaCreateBuffer(allocator_, &stagingbufferCreateInfo, &stagingbufferAllocationCreateInfo, &stagingbuffer, &stagingbufferAllocation,&stagingbufferAllocationInfo);
-
-            void* memory = nullptr;
-
-            vmaInvalidateAllocation(allocator_, stagingbufferAllocation, offset, sizeInBytes);
-            vmaMapMemory(allocator_, stagingbufferAllocation, &memory);
-            std::memcpy(static_cast<char*>(memory)+offset, data, sizeInBytes);
-            vmaUnmapMemory(allocator_, stagingbufferAllocation);
-            vmaFlushAllocation(allocator_, stagingbufferAllocation, offset, sizeInBytes);
-
+            vk::DeviceSize const sizeInBytes = vk::DeviceSize(width) * height * 4;
+            auto const [staging, from] = stage(data, sizeInBytes);
+            vk::CommandBuffer const commands = staging_frames_[staging_frame_].commands;
 
-            vk::CommandBufferBeginInfo cbbi;
-            cbbi.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
-            transfer_command_buffer_.begin(cbbi);
-
-
-            //copy staging buffer to image
             vk::ImageSubresourceRange isrr = {};
             isrr.aspectMask = vk::ImageAspectFlagBits::eColor;
             isrr.baseMipLevel = 0;
@@ -228,12 +421,12 @@ public:
             imbTransfer.srcQueueFamilyIndex = vk::QueueFamilyIgnored;
             imbTransfer.dstQueueFamilyIndex = vk::QueueFamilyIgnored;
 
-            transfer_command_buffer_.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, {}, {},{},imbTransfer);
+            commands.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, {}, {},{},imbTransfer);
 
 
             //copy pixel data to image from staging buffer
             vk::BufferImageCopy bic = {};
-            bic.bufferOffset = 0;
+            bic.bufferOffset = from;
             bic.bufferRowLength = 0;
             bic.bufferImageHeight = height;
 
@@ -243,10 +436,11 @@ public:
             bic.imageSubresource.layerCount = 1;
             bic.imageExtent = vk::Extent3D{width,height,1};
 
-            transfer_command_buffer_.copyBufferToImage(stagingbuffer,img,vk::ImageLayout::eTransferDstOptimal,bic);
+            commands.copyBufferToImage(staging,img,vk::ImageLayout::eTransferDstOptimal,bic);
 
 
-            //transition image layout to shader readonly optimal
+            //transition image layout to shader readonly optimal. between two families that is a release here and
+            //the same barrier as an acquire on the graphics queue, within one family the barrier does both
             vk::ImageMemoryBarrier imbReadable = {};
             imbReadable.oldLayout = vk::ImageLayout::eTransferDstOptimal;
             imbReadable.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
@@ -257,44 +451,296 @@ public:
             imbReadable.image = img;
             imbReadable.subresourceRange = isrr;
 
+            if(families_[0] != families_[1])
+            {
+                imbReadable.srcQueueFamilyIndex = families_[1];
+                imbReadable.dstQueueFamilyIndex = families_[0];
+
+                vk::ImageMemoryBarrier acquire = imbReadable;
+                acquire.srcAccessMask = vk::AccessFlagBits::eNone;
+                releases_.push_back(acquire);
+
+                imbReadable.dstAccessMask = vk::AccessFlagBits::eNone;
+                commands.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, {}, {},{},imbReadable);
+            }
+            else
+            {
+                commands.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, {}, {},{},imbReadable);
+            }
+        }
 
-            transfer_command_buffer_.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, {}, {},{},imbReadable);
 
-            transfer_command_buffer_.end();
 
-            vk::SubmitInfo si;
-            si.setCommandBuffers(transfer_command_buffer_);
-            transfer_queue_.submit(si);
+        return image;
+    }
 
-            transfer_queue_.waitIdle();
-            device_.waitIdle();
+    //does nothing for an image destroyed already
+    auto destroyImage(Image const & image) -> void
+    {
+        ImageAllocation const * const a = images_.get(image.slot);
+        if(a == nullptr) { return; }
 
-            vmaDestroyBuffer(allocator_,stagingbuffer, stagingbufferAllocation);
+        account(MemoryUse::images, a->info.size, false);
+        vmaDestroyImage(allocator_, a->image, a->allocation);
+        images_.erase(image.slot);
+    }
+
+    //what the memory is used for now and at most, how fragmented vulkan's blocks are and how much of the device
+    //memory budget is used, to budget vram with
+    [[nodiscard]] auto stats() const -> MemoryStats
+    {
+        MemoryStats s;
+        s.bytes = bytes_;
+        s.peak = peak_;
+
+        VmaTotalStatistics total = {};
+        vmaCalculateStatistics(allocator_, &total);
+        s.blockBytes = total.total.statistics.blockBytes;
+        s.allocationBytes = total.total.statistics.allocationBytes;
+
+        VkPhysicalDeviceMemoryProperties const * props = nullptr;
+        vmaGetMemoryProperties(allocator_, &props);
+        std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> budgets = {};
+        vmaGetHeapBudgets(allocator_, budgets.data());
+        for(uint32_t h = 0; h < props->memoryHeapCount; ++h)
+        {
+            if(props->memoryHeaps[h].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+            {
+                s.deviceUsage += budgets[h].usage;
+                s.deviceBudget += budgets[h].budget;
+            }
         }
+        return s;
+    }
 
+private:
+    //the staging ring is STAGING_FRAMES parts of STAGING_FRAME_SIZE bytes, one per batch of copies, so a batch
+    //only waits for the one STAGING_FRAMES batches before it, which is long done by the time it comes around.
+    //a copy that does not fit the rest of the part gets a staging buffer of its own that lives until its batch
+    //is done, so a batch is only ever submitted by flush()
+    static constexpr uint32_t STAGING_FRAMES = 3;
+    static constexpr vk::DeviceSize STAGING_FRAME_SIZE = 8 << 20;
+    static constexpr vk::DeviceSize STAGING_ALIGNMENT = 16;
+
+    struct StagingFrame
+    {
+        vk::CommandBuffer commands;
+        uint64_t ticket = 0;
+        vk::DeviceSize used = 0;
+        bool recording = false;
+        std::vector<std::pair<VkBuffer, VmaAllocation>> oversized;
+    };
+
+    struct BufferAllocation
+    {
+        vk::Buffer buffer;
+        VmaAllocation allocation;
+        VmaAllocationInfo info;
+        MemoryUse use;
+    };
 
+    struct ImageAllocation
+    {
+        vk::Image image;
+        VmaAllocation allocation;
+        VmaAllocationInfo info;
+    };
 
-        return img;
+    [[nodiscard]] auto allocation_of(Buffer const & buffer) const -> BufferAllocation const &
+    {
+        BufferAllocation const * const a = buffers_.get(buffer.slot);
+        if(a == nullptr) { throw std::runtime_error("buffer was destroyed!"); }
+        return *a;
     }
 
-    auto destroyImage(vk::Image image) -> void
+    auto account(MemoryUse const use, vk::DeviceSize const size, bool const added) -> void
     {
-        auto i = VkImage(image);
-        vmaDestroyImage(allocator_, i, images_[image].first);
-        images_.erase(image);
+        auto const u = static_cast<size_t>(use);
+        bytes_[u] = added ? bytes_[u] + size : bytes_[u] - size;
+        peak_[u] = std::max(peak_[u], bytes_[u]);
+    }
+
+    auto create_staging() -> void
+    {
+        VmaAllocationCreateInfo stagingbufferAllocationCreateInfo = {};
+        stagingbufferAllocationCreateInfo.usage = VMA_MEMORY_USAGE_AUTO;
+        stagingbufferAllocationCreateInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+        VkBufferCreateInfo stagingbufferCreateInfo = {};
+        stagingbufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        stagingbufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        stagingbufferCreateInfo.size = STAGING_FRAMES * STAGING_FRAME_SIZE;
+        VmaAllocationInfo stagingbufferAllocationInfo = {};
+        VkBuffer stagingbuffer = {};
+        vmaCreateBuffer(allocator_, &stagingbufferCreateInfo, &stagingbufferAllocationCreateInfo, &stagingbuffer, &staging_allocation_, &stagingbufferAllocationInfo);
+        account(MemoryUse::staging, stagingbufferAllocationInfo.size, true);
+        staging_buffer_ = stagingbuffer;
+        staging_memory_ = static_cast<char*>(stagingbufferAllocationInfo.pMappedData);
+
+        vk::CommandBufferAllocateInfo cbai;
+        cbai.setCommandBufferCount(STAGING_FRAMES);
+        cbai.setCommandPool(transfer_pool_);
+        cbai.setLevel(vk::CommandBufferLevel::ePrimary);
+        auto const commands = device_.allocateCommandBuffers(cbai);
+
+        for(uint32_t i = 0; i < STAGING_FRAMES; ++i)
+        {
+            staging_frames_[i].commands = commands[i];
+        }
+    }
+
+    //after the device is idle
+    auto destroy_staging() -> void
+    {
+        for(auto& f : staging_frames_)
+        {
+            release_oversized(f);
+        }
+        vmaDestroyBuffer(allocator_, staging_buffer_, staging_allocation_);
+    }
+
+    auto release_oversized(StagingFrame& f) -> void
+    {
+        for(auto const & [buffer, allocation] : f.oversized)
+        {
+            VmaAllocationInfo info = {};
+            vmaGetAllocationInfo(allocator_, allocation, &info);
+            account(MemoryUse::staging, info.size, false);
+            vmaDestroyBuffer(allocator_, buffer, allocation);
+        }
+        f.oversized.clear();
+    }
+
+    //starts the batch of the current part of the ring if it has not been, which waits for the last batch that
+    //used the part to finish
+    auto begin_staging() -> StagingFrame&
+    {
+        StagingFrame& f = staging_frames_[staging_frame_];
+        if(f.recording) { return f; }
+
+        vk::SemaphoreWaitInfo swi;
+        swi.setSemaphores(uploads_);
+        swi.setValues(f.ticket);
+        if(device_.waitSemaphores(swi, UINT64_MAX) != vk::Result::eSuccess)
+        {
+            throw std::runtime_error("failed to wait for the staging ring!");
+        }
+        release_oversized(f);
+        f.used = 0;
+
+        vk::CommandBufferBeginInfo cbbi;
+        cbbi.setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+        f.commands.begin(cbbi);
+        f.recording = true;
+        return f;
+    }
+
+    //records a copy into the batch. copies in a batch run in any order, so a copy to a buffer the batch wrote to
+    //already waits for the copies before it
+    auto copy(vk::Buffer staging, vk::Buffer buffer, std::span<vk::BufferCopy const> regions) -> void
+    {
+        vk::CommandBuffer const commands = staging_frames_[staging_frame_].commands;
+        if(std::find(written_.begin(), written_.end(), buffer) != written_.end())
+        {
+            vk::MemoryBarrier mb;
+            mb.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite);
+            mb.setDstAccessMask(vk::AccessFlagBits::eTransferWrite);
+            commands.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, {}, mb, {}, {});
+            written_.clear();
+        }
+        written_.push_back(buffer);
+        commands.copyBuffer(staging, buffer, static_cast<uint32_t>(regions.size()), regions.data());
+    }
+
+    //writes a host buffer in place, false for a device buffer
+    auto write_mapped(Buffer const & buffer, vk::DeviceSize const offset, vk::DeviceSize const size, void const * data) -> bool
+    {
+        BufferAllocation const & a = allocation_of(buffer);
+        if(a.info.pMappedData == nullptr) { return false; }
+
+        std::memcpy(static_cast<char*>(a.info.pMappedData) + offset, data, size);
+        vmaFlushAllocation(allocator_, a.allocation, offset, size);
+        return true;
+    }
+
+    //size bytes of staging, at offset in buffer and mapped at memory, written with write() before the batch goes out
+    struct Staged
+    {
+        vk::Buffer buffer;
+        vk::DeviceSize offset = 0;
+        char* memory = nullptr;
+        VmaAllocation allocation = {};
+    };
+
+    //takes size bytes of the ring, or of a staging buffer of their own when the rest of the part is too small
+    auto reserve(vk::DeviceSize const size) -> Staged
+    {
+        StagingFrame& f = begin_staging();
+        vk::DeviceSize const offset = (f.used + STAGING_ALIGNMENT - 1) / STAGING_ALIGNMENT * STAGING_ALIGNMENT;
+
+        if(offset + size > STAGING_FRAME_SIZE)
+        {
+            VmaAllocationCreateInfo stagingbufferAllocationCreateInfo = {};
+            stagingbufferAllocationCreateInfo.usage = VMA_MEMORY_USAGE_AUTO;
+            stagingbufferAllocationCreateInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+            VkBufferCreateInfo stagingbufferCreateInfo = {};
+            stagingbufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            stagingbufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+            stagingbufferCreateInfo.size = size;
+            VkBuffer stagingbuffer = {};
+            VmaAllocation stagingbufferAllocation = {};
+            VmaAllocationInfo stagingbufferAllocationInfo = {};
+            vmaCreateBuffer(allocator_, &stagingbufferCreateInfo, &stagingbufferAllocationCreateInfo, &stagingbuffer, &stagingbufferAllocation, &stagingbufferAllocationInfo);
+
+            account(MemoryUse::staging, stagingbufferAllocationInfo.size, true);
+            f.oversized.emplace_back(stagingbuffer, stagingbufferAllocation);
+            return {stagingbuffer, 0, static_cast<char*>(stagingbufferAllocationInfo.pMappedData), stagingbufferAllocation};
+        }
+
+        vk::DeviceSize const from = staging_frame_ * STAGING_FRAME_SIZE + offset;
+        f.used = offset + size;
+        return {staging_buffer_, from, staging_memory_ + from, staging_allocation_};
+    }
+
+    //copies size bytes of data to at bytes into the staging
+    auto write(Staged const & staged, vk::DeviceSize const at, void const * data, vk::DeviceSize const size) -> void
+    {
+        std::memcpy(staged.memory + at, data, size);
+        vmaFlushAllocation(allocator_, staged.allocation, staged.offset + at, size);
+    }
+
+    //copies data into the ring and returns the staging buffer and offset it is at
+    auto stage(void const * data, vk::DeviceSize const size) -> std::pair<vk::Buffer, vk::DeviceSize>
+    {
+        Staged const staged = reserve(size);
+        write(staged, 0, data, size);
+        return {staged.buffer, staged.offset};
     }
 
-private:
     VmaAllocator allocator_ = nullptr;
     vk::Instance instance_;
     vk::Device device_;
     vk::PhysicalDevice physical_device_;
+    std::array<uint32_t, 2> families_;            //graphics, transfer
     vk::CommandPool transfer_pool_;
-    vk::CommandBuffer transfer_command_buffer_;
     vk::Queue transfer_queue_;
-
-    std::map<vk::Buffer, std::pair<VmaAllocation, VmaAllocationInfo>> buffers_;
-    std::map<vk::Image, std::pair<VmaAllocation, VmaAllocationInfo>> images_;
+    vk::Semaphore uploads_;
+    uint64_t ticket_ = 0;
+
+    vk::Buffer staging_buffer_;
+    VmaAllocation staging_allocation_ = {};
+    char* staging_memory_ = nullptr;
+    std::array<StagingFrame, STAGING_FRAMES> staging_frames_;
+    uint32_t staging_frame_ = 0;
+    std::vector<vk::BufferCopy> staged_regions_;
+    std::vector<std::pair<Buffer, vk::BufferCopy>> staged_copies_;
+    std::vector<vk::Buffer> written_;             //by the batch since its last barrier
+    std::vector<vk::ImageMemoryBarrier> releases_;    //by the batch, acquired once it is flushed
+    std::vector<vk::ImageMemoryBarrier> acquires_;    //for the next acquire()
+
+    SlotTable<BufferAllocation> buffers_;
+    SlotTable<ImageAllocation> images_;
+    std::array<vk::DeviceSize, MEMORY_USES> bytes_{};
+    std::array<vk::DeviceSize, MEMORY_USES> peak_{};
 };
 
 }
@@ -3,8 +3,12 @@
 #include <vulkan/vulkan.hpp>
 
 #include <array>
+#include <cstddef>
+#include <deque>
+#include <map>
 #include <string>
 #include <algorithm>
+#include <vector>
 
 #include "util/fixed_vector.hpp"
 #include "util/read_file.hpp"
@@ -18,7 +22,9 @@
 #include "light.hpp"
 #include "renderobject.hpp"
 #include "game/camera.hpp"
+#include "game/citygen/cityworker.hpp"
 #include "game/citygen/grid.hpp"
+#include "game/terrainstreamer.hpp"
 
 
 #include "glm/glm.hpp"
@@ -198,7 +204,7 @@ public:
         device_.destroyPipelineLayout(pipeline_layout_);
         for(auto& p : pipelines_) {device_.destroyPipeline(p);}
 
-        auto destroyBuffers = [this](std::vector<vk::Buffer>& v) { for (auto& b : v) {memory_manager_.destroyBuffer(b);} };
+        auto destroyBuffers = [this](std::vector<MemoryManager::Buffer>& v) { for (auto& b : v) {memory_manager_.destroyBuffer(b);} };
 
         destroyBuffers(model_matricies_buffers_);
         destroyBuffers(materials_buffers_);
@@ -241,28 +247,6 @@ public:
         setClearColor(20/255.0f,20/255.0f,245/255.0f,1.0f);
 
 
-        memory_manager_.updateBuffer(materials_buffers_[currentFrame], 0,
-                                     materials_.getCurrentSizeInBytes(),
-                                     materials_.data());
-
-
-        memory_manager_.updateBuffer(model_matricies_buffers_[currentFrame], 0,
-                                     model_matricies_.getCurrentSizeInBytes(),
-                                     model_matricies_.data());
-
-
-
-
-        memory_manager_.updateBuffer(cameras_buffers_[currentFrame], 0,
-                                     cameras_.getCurrentSizeInBytes(),
-                                     cameras_.data());
-
-
-        memory_manager_.updateBuffer( lights_buffers_[currentFrame], 0,
-                                      lights_.getCurrentSizeInBytes(),
-                                      lights_.data());
-
-
 
         //loop through all render objects per frame, count mesh instances,upload vertbuffers, patch mesh infos
         //group render_objets for instacning, adject base index for shader lookup, upload ROs, use meshinfos for drawindirect commands
@@ -329,14 +313,28 @@ public:
             firstInstance += count;
         }
 
-        memory_manager_.updateBuffer(positions_buffers_[currentFrame], 0, positions.size()*sizeof(glm::vec4), positions.data());
-        memory_manager_.updateBuffer(indicies_buffers_[currentFrame],0,indicies.size()*sizeof(uint32_t),indicies.data());
-        memory_manager_.updateBuffer(texcoords_buffers_[currentFrame], 0, texcoords.size()*sizeof(glm::vec4), texcoords.data());
-        memory_manager_.updateBuffer(normals_buffers_[currentFrame], 0, normals.size()*sizeof(glm::vec4), normals.data());
-
-
-        memory_manager_.updateBuffer(render_objects_buffers_[currentFrame], 0, render_objects_.getSize()*sizeof(RenderObject), render_objects_.data());
-        memory_manager_.updateBuffer(draw_commands_buffers_[currentFrame], 0, diics.size() * sizeof(vk::DrawIndexedIndirectCommand), diics.data());
+        //everything the frame rewrites goes up as one batch of regions, packed into the staging ring together
+        std::array<MemoryManager::Region, 10> const frameRegions =
+        {{
+            {materials_buffers_[currentFrame], 0, materials_.getCurrentSizeInBytes(), materials_.data()},
+            {model_matricies_buffers_[currentFrame], 0, model_matricies_.getCurrentSizeInBytes(), model_matricies_.data()},
+            {cameras_buffers_[currentFrame], 0, cameras_.getCurrentSizeInBytes(), cameras_.data()},
+            {lights_buffers_[currentFrame], 0, lights_.getCurrentSizeInBytes(), lights_.data()},
+            {positions_buffers_[currentFrame], 0, positions.size() * sizeof(glm::vec4), positions.data()},
+            {indicies_buffers_[currentFrame], 0, indicies.size() * sizeof(uint32_t), indicies.data()},
+            {texcoords_buffers_[currentFrame], 0, texcoords.size() * sizeof(glm::vec4), texcoords.data()},
+            {normals_buffers_[currentFrame], 0, normals.size() * sizeof(glm::vec4), normals.data()},
+            {render_objects_buffers_[currentFrame], 0, render_objects_.getSize() * sizeof(RenderObject), render_objects_.data()},
+            {draw_commands_buffers_[currentFrame], 0, diics.size() * sizeof(vk::DrawIndexedIndirectCommand), diics.data()},
+        }};
+        memory_manager_.updateBuffers(frameRegions);
+        replayFrameUpdates(currentFrame);
+
+        //every upload of the frame, these and the terrain and grid updates its buffers have not got yet, goes out
+        //as one batch on the transfer queue, the frame takes over what it released and waits for it when it is
+        //submitted
+        memory_manager_.flush();
+        memory_manager_.acquire(window_.currentCommandBuffer());
 
         vk::RenderPassBeginInfo rpBeginInfo;
         rpBeginInfo.renderPass = window_.defaultRenderPass();
@@ -355,9 +353,9 @@ public:
         cmdbuf.setScissor(0,scissor_);
 
         cmdbuf.bindIndexBuffer(indicies_buffers_[currentFrame],0,vk::IndexType::eUint32);
-        cmdbuf.bindVertexBuffers(0,positions_buffers_[currentFrame], {0});
-        cmdbuf.bindVertexBuffers(1,texcoords_buffers_[currentFrame], {0});
-        cmdbuf.bindVertexBuffers(2,normals_buffers_[currentFrame], {0});
+        cmdbuf.bindVertexBuffers(0,positions_buffers_[currentFrame].buffer, {0});
+        cmdbuf.bindVertexBuffers(1,texcoords_buffers_[currentFrame].buffer, {0});
+        cmdbuf.bindVertexBuffers(2,normals_buffers_[currentFrame].buffer, {0});
 
         cmdbuf.drawIndexedIndirect(draw_commands_buffers_[currentFrame],0,diics.size(),sizeof(vk::DrawIndexedIndirectCommand));
         if(twimtbp_) {device_.waitIdle();}
@@ -370,11 +368,12 @@ public:
         cmdbuf.setScissor(0,scissor_);
 
         cmdbuf.bindIndexBuffer(indicies_buffers_[currentFrame],0,vk::IndexType::eUint32);
-        cmdbuf.bindVertexBuffers(0,positions_buffers_[currentFrame], {0});
-        cmdbuf.bindVertexBuffers(1,texcoords_buffers_[currentFrame], {0});
-        cmdbuf.bindVertexBuffers(2,normals_buffers_[currentFrame], {0});
+        cmdbuf.bindVertexBuffers(0,positions_buffers_[currentFrame].buffer, {0});
+        cmdbuf.bindVertexBuffers(1,texcoords_buffers_[currentFrame].buffer, {0});
+        cmdbuf.bindVertexBuffers(2,normals_buffers_[currentFrame].buffer, {0});
 
-        cmdbuf.drawIndexed(TERRAIN_MESH_INDEX_COUNT,terrain_width_*terrain_height_,0,0,0);
+        //every slot is drawn, terrain.vert collapses what is not resident or off the map
+        cmdbuf.drawIndexed(TERRAIN_MESH_INDEX_COUNT,TERRAIN_WINDOW*TERRAIN_WINDOW,0,0,0);
 
 
         if(twimtbp_) {device_.waitIdle();}
@@ -387,9 +386,9 @@ public:
         cmdbuf.setScissor(0,scissor_);
 
         cmdbuf.bindIndexBuffer(indicies_buffers_[currentFrame],0,vk::IndexType::eUint32);
-        cmdbuf.bindVertexBuffers(0,positions_buffers_[currentFrame], {0});
-        cmdbuf.bindVertexBuffers(1,texcoords_buffers_[currentFrame], {0});
-        cmdbuf.bindVertexBuffers(2,normals_buffers_[currentFrame], {0});
+        cmdbuf.bindVertexBuffers(0,positions_buffers_[currentFrame].buffer, {0});
+        cmdbuf.bindVertexBuffers(1,texcoords_buffers_[currentFrame].buffer, {0});
+        cmdbuf.bindVertexBuffers(2,normals_buffers_[currentFrame].buffer, {0});
 
         //draw water here!!!!!!
         //cmdbuf.draw(water_mesh_.getPositions().size(), 1, TERRAIN_MESH_VERT_COUNT * 14, 0);
@@ -505,55 +504,254 @@ public:
         render_objects_.erase(i);
     }
 
-    auto updateTerrain(uint32_t * ters, uint32_t * alts) -> void
+    //uploads a whole terrain of at most TERRAIN_WINDOW x TERRAIN_WINDOW tiles, sized with resizeTerrain() before.
+    //tile shapes and heights go up a byte each, cut into the chunk slots TerrainStreamer uses with the window at
+    //the top left, so both draw the same way. every frame in flight gets it when it comes around, see FrameUpdate
+    auto updateTerrain(uint8_t const * ters, uint8_t const * alts) -> void
+    {
+        using Streamer = game::TerrainStreamer;
+        constexpr size_t CELLS = Streamer::CHUNK_CELLS;
+
+        uint32_t const w = std::min(terrain_width_, TERRAIN_WINDOW);
+        uint32_t const h = std::min(terrain_height_, TERRAIN_WINDOW);
+        std::vector<uint8_t> slots(2 * Streamer::SLOTS * CELLS, 0);
+        for(uint32_t y = 0; y < h; ++y)
+        {
+            for(uint32_t x = 0; x < w; x += Streamer::CHUNK)
+            {
+                size_t const slot = (y / Streamer::CHUNK) * Streamer::RING + x / Streamer::CHUNK;
+                size_t const dst = slot * CELLS + (y % Streamer::CHUNK) * Streamer::CHUNK;
+                uint32_t const n = std::min(Streamer::CHUNK, w - x);
+                std::copy_n(alts + static_cast<size_t>(y) * terrain_width_ + x, n, slots.begin() + dst);
+                std::copy_n(ters + static_cast<size_t>(y) * terrain_width_ + x, n, slots.begin() + Streamer::SLOTS * CELLS + dst);
+            }
+        }
+
+        vk::DeviceSize const size = Streamer::SLOTS * CELLS;
+        vk::BufferCopy const copy{0, 0, size};
+        updateEveryFrame(terrain_alts_buffers_, std::span(&copy, 1), size, slots.data());
+        updateEveryFrame(terrain_ters_buffers_, std::span(&copy, 1), size, slots.data() + size);
+
+        uint32_t resident = 0;
+        for(uint32_t s = 0; s < Streamer::SLOTS; ++s)
+        {
+            if((s % Streamer::RING) * Streamer::CHUNK < w && (s / Streamer::RING) * Streamer::CHUNK < h) { resident |= 1u << s; }
+        }
+        setTerrainWindow(0, 0, resident);
+    }
+
+    //uploads the tiles x to x + w and y to y + h of a terrain updateTerrain() uploaded whole before, such as the
+    //rectangle a Terrain brush returns. the rows of the rectangle are cut at the slot edges and go up as one
+    //batched copy per map, so an edit costs its rectangle and not the map
+    auto updateTerrain(uint8_t const * ters, uint8_t const * alts, uint32_t const x, uint32_t const y, uint32_t const w, uint32_t const h) -> void
     {
-        for(auto& b : terrain_alts_buffers_)
+        using Streamer = game::TerrainStreamer;
+        constexpr vk::DeviceSize CELLS = Streamer::CHUNK_CELLS;
+
+        uint32_t const x1 = std::min({x + w, terrain_width_, TERRAIN_WINDOW});
+        uint32_t const y1 = std::min({y + h, terrain_height_, TERRAIN_WINDOW});
+        if(x >= x1 || y >= y1) { return; }
+
+        vk::DeviceSize const size = static_cast<vk::DeviceSize>(x1 - x) * (y1 - y);
+        std::vector<uint8_t> staging(2 * size);
+        std::vector<vk::BufferCopy> altsCopies;
+        std::vector<vk::BufferCopy> tersCopies;
+        vk::DeviceSize src = 0;
+        for(uint32_t ty = y; ty < y1; ++ty)
         {
-            memory_manager_.updateBuffer(b,0,terrain_width_*terrain_height_*sizeof(uint32_t), alts);
+            for(uint32_t tx = x; tx < x1;)
+            {
+                uint32_t const n = std::min(x1, (tx / Streamer::CHUNK + 1) * Streamer::CHUNK) - tx;
+                vk::DeviceSize const slot = (ty / Streamer::CHUNK) * Streamer::RING + tx / Streamer::CHUNK;
+                vk::DeviceSize const dst = slot * CELLS + (ty % Streamer::CHUNK) * Streamer::CHUNK + tx % Streamer::CHUNK;
+                size_t const map = static_cast<size_t>(ty) * terrain_width_ + tx;
+                std::copy_n(alts + map, n, staging.begin() + src);
+                std::copy_n(ters + map, n, staging.begin() + size + src);
+                altsCopies.push_back(vk::BufferCopy{src, dst, n});
+                tersCopies.push_back(vk::BufferCopy{size + src, dst, n});
+                src += n;
+                tx += n;
+            }
         }
-        for(auto& b : terrain_ters_buffers_)
+        updateEveryFrame(terrain_alts_buffers_, altsCopies, 2 * size, staging.data());
+        updateEveryFrame(terrain_ters_buffers_, tersCopies, 2 * size, staging.data());
+    }
+
+    //uploads the chunks a TerrainStreamer paged in, each to its slot, as one batched copy per map
+    auto updateTerrain(game::TerrainStreamer::Delta const & delta) -> void
+    {
+        using Chunk = game::TerrainStreamer::Chunk;
+        constexpr vk::DeviceSize CELLS = game::TerrainStreamer::CHUNK_CELLS;
+
+        std::vector<vk::BufferCopy> altsCopies;
+        std::vector<vk::BufferCopy> tersCopies;
+        for(size_t i = 0; i < delta.size(); ++i)
         {
-            memory_manager_.updateBuffer(b,0,terrain_width_*terrain_height_*sizeof(uint32_t), ters);
+            vk::DeviceSize const chunk = i * sizeof(Chunk);
+            altsCopies.push_back(vk::BufferCopy{chunk + offsetof(Chunk, alts), delta[i].slot * CELLS, CELLS});
+            tersCopies.push_back(vk::BufferCopy{chunk + offsetof(Chunk, ters), delta[i].slot * CELLS, CELLS});
         }
+        updateEveryFrame(terrain_alts_buffers_, altsCopies, delta.size() * sizeof(Chunk), delta.data());
+        updateEveryFrame(terrain_ters_buffers_, tersCopies, delta.size() * sizeof(Chunk), delta.data());
     }
 
+    //the window of chunks drawn and which slots hold the chunks it wants, see TerrainStreamer
+    auto setTerrainWindow(uint32_t const chunkX, uint32_t const chunkY, uint32_t const residentMask) -> void
+    {
+        push_constant_struct_.terrainWindowX = chunkX;
+        push_constant_struct_.terrainWindowY = chunkY;
+        push_constant_struct_.terrainResident = residentMask;
+    }
+
+    //the size of the whole map, streamed or not. the grid is laid over its top left corner
     auto resizeTerrain(uint32_t const w, uint32_t const h) -> void
     {
         terrain_width_ = w;
         terrain_height_ = h;
+        push_constant_struct_.terrainWidth = w;
+        push_constant_struct_.terrainHeight = h;
+        push_constant_struct_.gridWidth = std::min(w, MAX_TERRAIN_WIDTH_);
+        push_constant_struct_.gridHeight = std::min(h, MAX_TERRAIN_HEIGHT_);
+    }
+
+    //uploads the packed cells under the terrain, laid out like the terrain so terrain.vert can unpack them
+    //with gridType(idx). only the rows the grid marked dirty since the last call are packed into grid_cells_
+    //and go up as one batched copy, everything goes up when the grid or the terrain size changed
+    auto updateGrid(game::citygen::Grid<> & grid) -> void
+    {
+        using Cell = game::citygen::GridCell;
+        static_assert(Cell::BITS == GRID_CELL_BITS && Cell::TYPE_WIDTH == GRID_TYPE_BITS,
+                      "grid cells have to match gridCellBits and gridTypeBits in common.glsl");
+
+        auto const w = static_cast<int32_t>(push_constant_struct_.gridWidth);
+        auto const h = static_cast<int32_t>(push_constant_struct_.gridHeight);
+        if(&grid != uploaded_grid_ || w != uploaded_grid_width_ || h != uploaded_grid_height_)
+        {
+            uploaded_grid_ = &grid;
+            uploaded_grid_width_ = w;
+            uploaded_grid_height_ = h;
+            grid.consumeDirty([](int32_t, int32_t, int32_t, int32_t) {});
+
+            auto const count = static_cast<size_t>(w) * h;
+            grid_cells_.resize(count);
+            grid.copyRegion(0, 0, 0, w, h, grid_cells_);
+            vk::BufferCopy const copy{0, 0, sizeof(Cell) * count};
+            updateEveryFrame(grid_buffers_, std::span(&copy, 1), copy.size, grid_cells_.data());
+            return;
+        }
+
+        grid_cells_.clear();
+        grid_regions_.clear();
+        grid.consumeDirty([&](int32_t const x, int32_t const y, int32_t const z, int32_t const runWidth)
+        {
+            //the terrain only shows the first layer and only as much of the grid as it covers
+            int32_t const runEnd = std::min(x + runWidth, w);
+            if(z != 0 || y >= h || runEnd <= x) { return; }
+
+            vk::DeviceSize const src = grid_cells_.size() * sizeof(Cell);
+            vk::DeviceSize const dst = (static_cast<vk::DeviceSize>(y) * w + x) * sizeof(Cell);
+            vk::DeviceSize const size = static_cast<vk::DeviceSize>(runEnd - x) * sizeof(Cell);
+
+            grid_cells_.resize(grid_cells_.size() + (runEnd - x));
+            grid.copyRegion(x, y, 0, runEnd - x, 1, std::span(grid_cells_).last(runEnd - x));
+
+            //runs come in row major order, a run that continues the last one in the buffer joins its copy
+            if(!grid_regions_.empty() && grid_regions_.back().dstOffset + grid_regions_.back().size == dst)
+            {
+                grid_regions_.back().size += size;
+            }
+            else
+            {
+                grid_regions_.push_back(vk::BufferCopy{src, dst, size});
+            }
+        });
+
+        updateEveryFrame(grid_buffers_, grid_regions_, grid_cells_.size() * sizeof(Cell), grid_cells_.data());
     }
 
-    template<uint64_t W, uint64_t H, uint64_t D>
-    auto updateGrid(std::array<game::citygen::Atom, W*H*D>& atoms) -> void
+    //the same for a grid owned by a CityWorker, the delta holds the packed cells already and goes up straight
+    //from where it is. the first delta of a worker is the whole grid, call resync() on the worker after the
+    //terrain size changed
+    auto updateGrid(game::citygen::GridDelta<> const & delta) -> void
     {
-        for(auto& b : grid_buffers_)
+        using Cell = game::citygen::GridCell;
+
+        auto const w = static_cast<int32_t>(push_constant_struct_.gridWidth);
+        auto const h = static_cast<int32_t>(push_constant_struct_.gridHeight);
+        grid_regions_.clear();
+        for(auto const & r : delta.runs)
         {
-            memory_manager_.updateBuffer(b, 0, sizeof(game::citygen::Atom)*W*H*D, atoms.data());
+            int32_t const runEnd = std::min(r.x + r.w, w);
+            if(r.z != 0 || r.y >= h || runEnd <= r.x) { continue; }
+
+            vk::DeviceSize const src = r.first * sizeof(Cell);
+            vk::DeviceSize const dst = (static_cast<vk::DeviceSize>(r.y) * w + r.x) * sizeof(Cell);
+            vk::DeviceSize const size = static_cast<vk::DeviceSize>(runEnd - r.x) * sizeof(Cell);
+
+            auto* const last = grid_regions_.empty() ? nullptr : &grid_regions_.back();
+            if(last && last->srcOffset + last->size == src && last->dstOffset + last->size == dst)
+            {
+                last->size += size;
+            }
+            else
+            {
+                grid_regions_.push_back(vk::BufferCopy{src, dst, size});
+            }
         }
+
+        updateEveryFrame(grid_buffers_, grid_regions_, delta.cells.size() * sizeof(Cell), delta.cells.data());
     }
 
 private:
 
+    //queues an update of buffers every frame in flight has a copy of, see FrameUpdate
+    auto updateEveryFrame(per_frame_in_flight_vector<MemoryManager::Buffer> const & buffers,
+                          std::span<vk::BufferCopy const> regions, vk::DeviceSize const sizeInBytes, void const * data) -> void
+    {
+        if(data == nullptr || sizeInBytes == 0 || regions.empty()) { return; }
+
+        auto const * const bytes = static_cast<std::byte const *>(data);
+        frame_updates_.push_back(FrameUpdate{&buffers, {regions.begin(), regions.end()}, {bytes, bytes + sizeInBytes},
+                                             (uint64_t{1} << MAX_FRAMES_IN_FLIGHT) - 1});
+    }
+
+    //hands the queued updates the copies of frame have not got yet to the batch of the frame, oldest first, so a
+    //later update of the same cells lands last
+    auto replayFrameUpdates(uint32_t const frame) -> void
+    {
+        uint64_t const bit = uint64_t{1} << frame;
+        for(auto& u : frame_updates_)
+        {
+            if((u.pending & bit) == 0) { continue; }
+            memory_manager_.updateBufferRegions(std::span(&(*u.buffers)[frame], 1), u.regions, u.data.size(), u.data.data());
+            u.pending &= ~bit;
+        }
+        while(!frame_updates_.empty() && frame_updates_.front().pending == 0) { frame_updates_.pop_front(); }
+    }
+
     auto init_buffers() -> void
     {
+        //what is rewritten whole every frame and small lives in host buffers, written in place without a copy
+        constexpr auto HOST = MemoryManager::BufferMemory::host;
+
         for(auto i = 0ul; i < MAX_FRAMES_IN_FLIGHT; ++i)
         {
-            materials_buffers_[i] = memory_manager_.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer,materials_.getMaxSizeInBytes());
-            model_matricies_buffers_[i] = memory_manager_.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer,model_matricies_.getMaxSizeInBytes());
-            lights_buffers_[i] = memory_manager_.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer,lights_.getMaxSizeInBytes());
-            cameras_buffers_[i] = memory_manager_.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer,cameras_.getMaxSizeInBytes());
-            render_objects_buffers_[i] = memory_manager_.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer,sizeof(RenderObject) * MAX_OBJECTS_COUNT);
+            materials_buffers_[i] = memory_manager_.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer,materials_.getMaxSizeInBytes(), nullptr, HOST);
+            model_matricies_buffers_[i] = memory_manager_.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer,model_matricies_.getMaxSizeInBytes(), nullptr, HOST);
+            lights_buffers_[i] = memory_manager_.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer,lights_.getMaxSizeInBytes(), nullptr, HOST);
+            cameras_buffers_[i] = memory_manager_.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer,cameras_.getMaxSizeInBytes(), nullptr, HOST);
+            render_objects_buffers_[i] = memory_manager_.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer,sizeof(RenderObject) * MAX_OBJECTS_COUNT, nullptr, HOST);
             positions_buffers_[i] = memory_manager_.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer,sizeof(glm::vec4) * MAX_VERTEX_COUNT);
             texcoords_buffers_[i] = memory_manager_.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer,sizeof(glm::vec4) * MAX_VERTEX_COUNT);
             normals_buffers_[i] = memory_manager_.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer,sizeof(glm::vec4) * MAX_VERTEX_COUNT);
 
-            terrain_alts_buffers_[i] = memory_manager_.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer,sizeof(uint32_t) * MAX_TERRAIN_HEIGHT_* MAX_TERRAIN_WIDTH_);
-            terrain_ters_buffers_[i] = memory_manager_.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer,sizeof(uint32_t) * MAX_TERRAIN_HEIGHT_* MAX_TERRAIN_WIDTH_);
+            terrain_alts_buffers_[i] = memory_manager_.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer,sizeof(uint8_t) * TERRAIN_WINDOW * TERRAIN_WINDOW);
+            terrain_ters_buffers_[i] = memory_manager_.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer,sizeof(uint8_t) * TERRAIN_WINDOW * TERRAIN_WINDOW);
 
             indicies_buffers_[i] = memory_manager_.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndexBuffer,sizeof(uint32_t) * MAX_VERTEX_COUNT);
-            draw_commands_buffers_[i] = memory_manager_.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer,sizeof(vk::DrawIndexedIndirectCommand) * MAX_OBJECTS_COUNT);
+            draw_commands_buffers_[i] = memory_manager_.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer,sizeof(vk::DrawIndexedIndirectCommand) * MAX_OBJECTS_COUNT, nullptr, HOST);
 
-            grid_buffers_[i] = memory_manager_.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer, MAX_TERRAIN_WIDTH_ * MAX_TERRAIN_HEIGHT_*sizeof(game::citygen::Atom));
+            grid_buffers_[i] = memory_manager_.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer, MAX_TERRAIN_WIDTH_ * MAX_TERRAIN_HEIGHT_ * GRID_CELL_BITS / 8);
 
         }
 
@@ -846,7 +1044,7 @@ private:
 
     auto update_descriptor_sets() -> void
     {
-        std::vector<per_frame_in_flight_vector<vk::Buffer>> buffers(32);
+        std::vector<per_frame_in_flight_vector<MemoryManager::Buffer>> buffers(32);
         for(auto& b : buffers)
         {
             b.resize(MAX_FRAMES_IN_FLIGHT);
@@ -967,7 +1165,7 @@ private:
     FixedVector<Mesh,1024> meshes_;
     std::vector<uint32_t> mesh_handles_;
 
-    vk::Image texture_atlas_;
+    MemoryManager::Image texture_atlas_;
     vk::ImageView texture_atlas_view_;
     vk::Sampler texture_atlas_sampler_;
 
@@ -980,24 +1178,40 @@ private:
 
     //gpu side data must be duplicated for each frame in flight
 
-    per_frame_in_flight_vector<vk::Buffer> indicies_buffers_;
-    per_frame_in_flight_vector<vk::Buffer> positions_buffers_;
-    per_frame_in_flight_vector<vk::Buffer> texcoords_buffers_;
-    per_frame_in_flight_vector<vk::Buffer> normals_buffers_;
+    per_frame_in_flight_vector<MemoryManager::Buffer> indicies_buffers_;
+    per_frame_in_flight_vector<MemoryManager::Buffer> positions_buffers_;
+    per_frame_in_flight_vector<MemoryManager::Buffer> texcoords_buffers_;
+    per_frame_in_flight_vector<MemoryManager::Buffer> normals_buffers_;
 
-    per_frame_in_flight_vector<vk::Buffer> render_objects_buffers_;
-    per_frame_in_flight_vector<vk::Buffer> materials_buffers_;
-    per_frame_in_flight_vector<vk::Buffer> cameras_buffers_;
-    per_frame_in_flight_vector<vk::Buffer> model_matricies_buffers_;
-    per_frame_in_flight_vector<vk::Buffer> lights_buffers_;
+    per_frame_in_flight_vector<MemoryManager::Buffer> render_objects_buffers_;
+    per_frame_in_flight_vector<MemoryManager::Buffer> materials_buffers_;
+    per_frame_in_flight_vector<MemoryManager::Buffer> cameras_buffers_;
+    per_frame_in_flight_vector<MemoryManager::Buffer> model_matricies_buffers_;
+    per_frame_in_flight_vector<MemoryManager::Buffer> lights_buffers_;
 
 
-    per_frame_in_flight_vector<vk::Buffer> terrain_alts_buffers_;
-    per_frame_in_flight_vector<vk::Buffer> terrain_ters_buffers_;
+    per_frame_in_flight_vector<MemoryManager::Buffer> terrain_alts_buffers_;
+    per_frame_in_flight_vector<MemoryManager::Buffer> terrain_ters_buffers_;
 
-    per_frame_in_flight_vector<vk::Buffer> draw_commands_buffers_;
+    per_frame_in_flight_vector<MemoryManager::Buffer> draw_commands_buffers_;
 
-    per_frame_in_flight_vector<vk::Buffer> grid_buffers_;
+    per_frame_in_flight_vector<MemoryManager::Buffer> grid_buffers_;
+    std::vector<game::citygen::GridCell> grid_cells_;
+    std::vector<vk::BufferCopy> grid_regions_;
+    game::citygen::Grid<> const * uploaded_grid_ = nullptr;
+    int32_t uploaded_grid_width_ = 0;
+    int32_t uploaded_grid_height_ = 0;
+
+    //an update of the terrain or grid buffers. the copy of a frame only gets it once that frame comes around and
+    //beginFrame() waited for it, so the transfer queue never writes a copy another frame in flight may still read
+    struct FrameUpdate
+    {
+        per_frame_in_flight_vector<MemoryManager::Buffer> const * buffers;
+        std::vector<vk::BufferCopy> regions;
+        std::vector<std::byte> data;
+        uint64_t pending; //a bit for each frame whose copy has not got it yet
+    };
+    std::deque<FrameUpdate> frame_updates_;
 
     //push constants
     struct PushConstantStruct
@@ -1007,12 +1221,12 @@ private:
         float oldTime;
         float currentTime;
         uint32_t terrainWidth;
-        uint32_t terriaiHeight;
-        uint32_t reseved6;
-        uint32_t reseved7;
-        uint32_t reseved8;
-        uint32_t reseved9;
-        uint32_t reseved10;
+        uint32_t terrainHeight;
+        uint32_t terrainWindowX;
+        uint32_t terrainWindowY;
+        uint32_t terrainResident;
+        uint32_t gridWidth;
+        uint32_t gridHeight;
         uint32_t reseved11;
         uint32_t reseved12;
         uint32_t reseved13;
@@ -1046,6 +1260,13 @@ private:
 
     uint32_t const MAX_TERRAIN_WIDTH_ = 256;
     uint32_t const MAX_TERRAIN_HEIGHT_ = 256;
+
+    //tiles along a side of what the terrain buffers hold, the slots of a TerrainStreamer
+    static constexpr uint32_t TERRAIN_WINDOW = game::TerrainStreamer::WINDOW;
+
+    //layout of the grid cells in binding 11, keep in sync with common.glsl
+    static constexpr uint32_t GRID_CELL_BITS = 8;
+    static constexpr uint32_t GRID_TYPE_BITS = 4;
     uint32_t const TERRAIN_MESH_INDEX_COUNT = 36;
     uint32_t const TERRAIN_MESH_VERT_COUNT = 36;
 
@@ -0,0 +1,35 @@
+#define STB_IMAGE_IMPLEMENTATION
+#include "util/stb_image.h"
+#undef STB_IMAGE_IMPLEMENTATION
+
+#include "game/terrain.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <exception>
+
+//converts a heightmap image to a terrain file: terrainconv <in.bmp|in.png> <out.vkt>
+//the terrain is made valid on the way, which is the one step that needs the whole map at once
+int main(int argc, char **argv)
+{
+    using namespace std::chrono;
+
+    if (argc != 3) {
+        std::fprintf(stderr, "usage: terrainconv <heightmap.bmp|heightmap.png> <terrain.vkt>\n");
+        return 2;
+    }
+
+    try {
+        auto const t1 = steady_clock::now();
+        vkopter::game::Terrain terrain;
+        terrain.loadImage(argv[1]);
+        terrain.makeValid();
+        terrain.save(argv[2]);
+        std::printf("%ux%u %s -> %s in %.2f ms\n", terrain.getWidth(), terrain.getHeight(), argv[1], argv[2],
+                    duration<double, std::milli>(steady_clock::now() - t1).count());
+    } catch (std::exception const &e) {
+        std::fprintf(stderr, "%s: %s\n", argv[1], e.what());
+        return 1;
+    }
+    return 0;
+}
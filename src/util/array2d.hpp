@@ -2,6 +2,7 @@
 
 #include <array>
 #include <vector>
+#include <cstddef>
 #include <cstdint>
 
 template<class T, uint64_t WIDTH, uint64_t HEIGHT>
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//a whole file mapped read only. nothing is read up front, the os pages in what gets touched, so looking at a
+//few parts of a big file only costs those parts
+class MappedFile
+{
+public:
+    explicit MappedFile(std::string const & filename)
+    {
+#ifdef _WIN32
+        file_ = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file_ == INVALID_HANDLE_VALUE) { throw std::runtime_error("failed to open file!"); }
+
+        LARGE_INTEGER size;
+        if(!GetFileSizeEx(file_, &size))
+        {
+            close();
+            throw std::runtime_error("failed to open file!");
+        }
+        size_ = static_cast<size_t>(size.QuadPart);
+        if(size_ == 0) { return; }
+
+        mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        data_ = mapping_ ? static_cast<std::byte const *>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+#else
+        int const fd = ::open(filename.c_str(), O_RDONLY);
+        if(fd < 0) { throw std::runtime_error("failed to open file!"); }
+
+        struct stat st;
+        if(fstat(fd, &st) != 0)
+        {
+            ::close(fd);
+            throw std::runtime_error("failed to open file!");
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if(size_ == 0)
+        {
+            ::close(fd);
+            return;
+        }
+
+        //the mapping keeps the file alive on its own
+        void* const p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        data_ = p == MAP_FAILED ? nullptr : static_cast<std::byte const *>(p);
+#endif
+        if(!data_)
+        {
+            close();
+            throw std::runtime_error("failed to map file!");
+        }
+    }
+
+    MappedFile(MappedFile const &) = delete;
+    auto operator=(MappedFile const &) -> MappedFile& = delete;
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    [[nodiscard]] auto data() const -> std::byte const * { return data_; }
+    [[nodiscard]] auto size() const -> size_t { return size_; }
+
+private:
+    std::byte const * data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+#endif
+
+    auto close() -> void
+    {
+#ifdef _WIN32
+        if(data_) { UnmapViewOfFile(data_); }
+        if(mapping_) { CloseHandle(mapping_); }
+        if(file_ != INVALID_HANDLE_VALUE) { CloseHandle(file_); }
+        mapping_ = nullptr;
+        file_ = INVALID_HANDLE_VALUE;
+#else
+        if(data_) { munmap(const_cast<std::byte*>(data_), size_); }
+#endif
+        data_ = nullptr;
+    }
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+//hardware counters of the calling thread (and the threads it starts after start()) through perf_event_open.
+//where the kernel or the platform does not allow it, available() is false and read() gives nothing
+class PerfCounters
+{
+public:
+    enum Counter : uint8_t
+    {
+        Cycles = 0,
+        Instructions,
+        CacheReferences,
+        CacheMisses,
+
+        NUM_COUNTERS
+    };
+
+    PerfCounters()
+    {
+#ifdef __linux__
+        constexpr std::array<uint64_t, NUM_COUNTERS> configs = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES
+        };
+        for(uint8_t i = 0; i < NUM_COUNTERS; ++i)
+        {
+            perf_event_attr attr{};
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds_[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+            if(fds_[i] < 0)
+            {
+                close();
+                return;
+            }
+        }
+#endif
+    }
+
+    PerfCounters(PerfCounters const &) = delete;
+    auto operator=(PerfCounters const &) -> PerfCounters& = delete;
+
+    ~PerfCounters()
+    {
+        close();
+    }
+
+    [[nodiscard]] auto available() const -> bool
+    {
+        return fds_[0] >= 0;
+    }
+
+    auto start() -> void
+    {
+#ifdef __linux__
+        for(int const fd : fds_)
+        {
+            if(fd < 0) { continue; }
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    auto stop() -> void
+    {
+#ifdef __linux__
+        for(int const fd : fds_)
+        {
+            if(fd >= 0) { ioctl(fd, PERF_EVENT_IOC_DISABLE, 0); }
+        }
+#endif
+    }
+
+    //counts between the last start() and stop()
+    [[nodiscard]] auto read() const -> std::optional<std::array<uint64_t, NUM_COUNTERS>>
+    {
+        if(!available()) { return std::nullopt; }
+
+        std::array<uint64_t, NUM_COUNTERS> values{};
+#ifdef __linux__
+        for(uint8_t i = 0; i < NUM_COUNTERS; ++i)
+        {
+            if(::read(fds_[i], &values[i], sizeof(uint64_t)) != sizeof(uint64_t)) { return std::nullopt; }
+        }
+#endif
+        return values;
+    }
+
+private:
+    std::array<int, NUM_COUNTERS> fds_ = {-1, -1, -1, -1};
+
+    auto close() -> void
+    {
+#ifdef __linux__
+        for(int& fd : fds_)
+        {
+            if(fd >= 0) { ::close(fd); }
+            fd = -1;
+        }
+#endif
+    }
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+//values kept densely in a vector and reached through handles in O(1). a handle is the index of a slot and the
+//generation the slot had when the value went in, a slot moves on to the next generation when its value is
+//erased, so a handle that outlived its value finds nothing instead of whatever took the slot over.
+//erasing moves the last value into the hole, so the values are always contiguous to iterate over, and the
+//slot of the moved value is pointed at its new place
+struct SlotHandle
+{
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+
+    friend auto operator==(SlotHandle const &, SlotHandle const &) -> bool = default;
+};
+
+template<class T>
+class SlotTable
+{
+public:
+    auto insert(T value) -> SlotHandle
+    {
+        uint32_t index;
+        if(free_.empty())
+        {
+            index = static_cast<uint32_t>(slots_.size());
+            slots_.push_back({});
+        }
+        else
+        {
+            index = free_.back();
+            free_.pop_back();
+        }
+
+        Slot& s = slots_[index];
+        s.dense = static_cast<uint32_t>(values_.size());
+        values_.push_back(std::move(value));
+        owners_.push_back(index);
+        return {index, s.generation};
+    }
+
+    //nullptr for a handle whose value was erased
+    [[nodiscard]] auto get(SlotHandle const h) -> T*
+    {
+        return valid(h) ? &values_[slots_[h.index].dense] : nullptr;
+    }
+
+    [[nodiscard]] auto get(SlotHandle const h) const -> T const *
+    {
+        return valid(h) ? &values_[slots_[h.index].dense] : nullptr;
+    }
+
+    //false for a handle whose value was erased already
+    auto erase(SlotHandle const h) -> bool
+    {
+        if(!valid(h)) { return false; }
+
+        Slot& s = slots_[h.index];
+        uint32_t const last = static_cast<uint32_t>(values_.size() - 1);
+        if(s.dense != last)
+        {
+            values_[s.dense] = std::move(values_[last]);
+            owners_[s.dense] = owners_[last];
+            slots_[owners_[s.dense]].dense = s.dense;
+        }
+        values_.pop_back();
+        owners_.pop_back();
+
+        s.dense = NONE;
+        ++s.generation;
+        free_.push_back(h.index);
+        return true;
+    }
+
+    [[nodiscard]] auto valid(SlotHandle const h) const -> bool
+    {
+        return h.index < slots_.size() && slots_[h.index].generation == h.generation && slots_[h.index].dense != NONE;
+    }
+
+    [[nodiscard]] auto size() const -> size_t { return values_.size(); }
+
+    //the values, in no particular order
+    auto begin() { return values_.begin(); }
+    auto end() { return values_.end(); }
+    auto begin() const { return values_.begin(); }
+    auto end() const { return values_.end(); }
+
+    //the handle of the value at position i of the iteration
+    [[nodiscard]] auto handle(size_t const i) const -> SlotHandle
+    {
+        return {owners_[i], slots_[owners_[i]].generation};
+    }
+
+private:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    struct Slot
+    {
+        uint32_t dense = NONE;
+        uint32_t generation = 0;
+    };
+
+    std::vector<T> values_;
+    std::vector<uint32_t> owners_;    //the slot of every value
+    std::vector<Slot> slots_;
+    std::vector<uint32_t> free_;
+};
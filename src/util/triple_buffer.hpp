@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+//lock free handoff of T from one producer thread to one consumer thread. there are three slots: the producer
+//fills back(), the consumer reads front(), and the one in the middle holds the last thing published. neither
+//side ever waits for the other, publishing and taking are a single atomic exchange each.
+//publishing never overwrites something the consumer has not taken yet, tryPublish() fails instead and the
+//producer keeps its back slot, so T can be a delta that the producer goes on adding to
+template<class T>
+class TripleBuffer
+{
+public:
+    //producer side
+    auto back() -> T&
+    {
+        return slots_[back_];
+    }
+
+    //hands back() to the consumer and gives the producer the slot the consumer let go of, false while the
+    //last one published was not taken yet
+    auto tryPublish() -> bool
+    {
+        if(middle_.load(std::memory_order_acquire) & FRESH) { return false; }
+        back_ = middle_.exchange(back_ | FRESH, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    //consumer side, true when front() is something new
+    auto update() -> bool
+    {
+        if(!(middle_.load(std::memory_order_relaxed) & FRESH)) { return false; }
+        front_ = middle_.exchange(front_, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    auto front() -> T&
+    {
+        return slots_[front_];
+    }
+
+private:
+    static constexpr uint8_t INDEX = 3;
+    static constexpr uint8_t FRESH = 4;
+
+    std::array<T, 3> slots_;
+    alignas(64) std::atomic<uint8_t> middle_ = 1;
+    alignas(64) uint8_t back_ = 0;  //only touched by the producer
+    alignas(64) uint8_t front_ = 2; //only touched by the consumer
+};
@@ -11,6 +11,7 @@
 
 
 #include <cstdint>
+#include <string>
 
 #include "render/vk_mem_alloc.h"
 #include <vulkan/vulkan.hpp>
@@ -23,35 +24,72 @@
 #include "vulkanwindow.hpp"
 #include "game/citygen/grid.hpp"
 #include "game/citygen/atomupdater.hpp"
+#include "game/citygen/checkpoint.hpp"
+#include "game/citygen/cityworker.hpp"
 
 #include "glm/ext/matrix_transform.hpp"
 
 #include "game/terrain.hpp"
+#include "game/terrainstreamer.hpp"
 
 #include "util/stb_image.h"
 
 
 auto main(int argc, char **argv) -> int
 {
+    //--frames n quits after n frames, a debug build run like that is a smoke test under the validation layers
+    uint64_t framesLeft = UINT64_MAX;
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (std::string(argv[i]) == "--frames")
+        {
+            framesLeft = std::stoull(argv[i + 1]);
+        }
+    }
+
     vkopter::VulkanWindow window(1280, 720);
     vkopter::render::VulkanRenderer renderer(window, window.getMemoryManager());
 
-    vkopter::game::citygen::Grid<256, 256, 1> grid;
-    vkopter::game::citygen::AtomUpdater<256, 256, 1, 4> au(grid);
-    grid.clear();
-    grid(16, 16, 0) = vkopter::game::citygen::RoadNS;
-    for(auto i = 0ul; i < 1000000; ++i)
+    vkopter::game::citygen::Grid<> grid(256, 256);
+    vkopter::game::citygen::AtomUpdater<4> au(grid);
+
+    //the city is grown once and loaded from its checkpoint after that
+    std::string const cityCheckpoint = "citygen.ckpt";
+    try
     {
-        au.updateRnd();
+        vkopter::game::citygen::Checkpoint<> checkpoint(cityCheckpoint);
+        checkpoint.load(grid);
+        au.restore(checkpoint.updaterState());
     }
+    catch(std::runtime_error const &)
+    {
+        grid.clear();
+        grid(16, 16, 0) = vkopter::game::citygen::RoadNS;
+        au.updateParallel(1000000);
+        vkopter::game::citygen::Checkpoint<>::save(grid, au.state(), cityCheckpoint);
+    }
+
 
+    //the heightmap is converted once and streamed from its terrain file after that
+    std::string const terrainFile = "data/maps/test/hm.vkt";
+    try
+    {
+        vkopter::game::TerrainFile const existing(terrainFile);
+    }
+    catch(std::runtime_error const &)
+    {
+        vkopter::game::Terrain terrain;
+        terrain.loadImage("data/maps/test/hm.bmp");
+        terrain.makeValid();
+        terrain.save(terrainFile);
+    }
+    vkopter::game::TerrainStreamer terrainStream(terrainFile);
+    renderer.resizeTerrain(terrainStream.width(), terrainStream.height());
+    terrainStream.start();
 
-    vkopter::game::Terrain terrain;
-    terrain.load("data/maps/test/hm.bmp");
-    terrain.makeValid();
-    renderer.resizeTerrain(terrain.getWidth(), terrain.getHeight());
-    renderer.updateTerrain(terrain.termapData(), terrain.altmapData());
-    renderer.updateGrid<grid.WIDTH,grid.HEIGHT,grid.DEPTH>(grid.atoms());
+    //the city grows on its own thread from here on, the frames only upload what changed
+    vkopter::game::citygen::CityWorker city(grid, au, 60000);
+    city.start();
 
     auto mesh0 = renderer.createMesh("data/meshes/untitled.gltf");
     auto mat0 = renderer.createMaterial();
@@ -138,18 +176,30 @@ auto main(int argc, char **argv) -> int
             cam0ref.move({0.0f,1.0f,0.0f});
         }
 
-        for(auto i = 0ul; i < 1000; ++i)
+        cam0ref.update();
+
+        //the terrain window follows the camera, x runs along the map and z back up it
+        terrainStream.focus(cam0ref.position_.x, static_cast<float>(terrainStream.height()) - cam0ref.position_.z);
+        if(auto const * const chunks = terrainStream.latest())
         {
-            au.updateRnd();
+            renderer.updateTerrain(*chunks);
         }
+        renderer.setTerrainWindow(terrainStream.windowX(), terrainStream.windowY(), terrainStream.residentMask());
 
-        cam0ref.update();
-
-        renderer.updateGrid<grid.WIDTH,grid.HEIGHT,grid.DEPTH>(grid.atoms());
+        if(auto const * const delta = city.latest())
+        {
+            renderer.updateGrid(*delta);
+        }
         renderer.startNextFrame();
 
+        if (--framesLeft == 0)
+        {
+            running = false;
+        }
     }
 
+    city.stop();
+    terrainStream.stop();
     renderer.removeRenderObject(ro0ref);
     //renderer.removeRenderObject(ro1ref);
     //renderer.removeRenderObject(ro2ref);
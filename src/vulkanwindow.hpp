@@ -11,6 +11,7 @@
 #endif
 
 #include <array>
+#include <stdexcept>
 #include <vector>
 
 namespace vkopter
@@ -37,7 +38,8 @@ public:
         memoryManager = new render::MemoryManager(instance_,
                                                   device_,
                                                   physical_device_,
-                                                  graphicsQueueFamilyIndex());
+                                                  graphicsQueueFamilyIndex(),
+                                                  transferQueueFamilyIndex());
         create_surface();
 
         create_swapchain();
@@ -138,11 +140,17 @@ public:
     {
         default_command_buffers_[current_frame_].end();
         vk::SubmitInfo submitInfo;
-        vk::Semaphore waitSemaphores[] = {image_available_semaphore};
-        vk::PipelineStageFlags waitStages[] = {vk::PipelineStageFlagBits::eColorAttachmentOutput};
-        submitInfo.setWaitSemaphoreCount(1);
+
+        //the frame also waits for the uploads flushed for it, the value of the image semaphore is ignored
+        vk::Semaphore waitSemaphores[] = {image_available_semaphore, memoryManager->uploadSemaphore()};
+        vk::PipelineStageFlags waitStages[] = {vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::PipelineStageFlagBits::eAllCommands};
+        uint64_t waitValues[] = {0, memoryManager->ticket()};
+        vk::TimelineSemaphoreSubmitInfo timelineInfo;
+        timelineInfo.setWaitSemaphoreValues(waitValues);
+        submitInfo.setWaitSemaphoreCount(2);
         submitInfo.setWaitSemaphores(waitSemaphores);
         submitInfo.setWaitDstStageMask(waitStages);
+        submitInfo.setPNext(&timelineInfo);
         submitInfo.setCommandBufferCount(1);
         submitInfo.setCommandBuffers(default_command_buffers_[current_frame_]);
 
@@ -207,7 +215,7 @@ private:
     std::vector<vk::ImageView> swapchain_image_views_;
     std::vector<vk::Framebuffer> swapchain_framebuffers_;
     vk::Format depth_format_ = vk::Format::eD32Sfloat;
-    vk::Image depth_image_;
+    render::MemoryManager::Image depth_image_;
     vk::ImageView depth_image_view_;
 
     vk::CommandPool default_command_pool_;
@@ -296,24 +304,38 @@ private:
         instance_.destroy();
     }
 
+    //the uploads are tracked with a timeline semaphore, so the device has to be 1.2 and support them
     auto pick_physical_device() -> void
     {
-        auto pdevs = instance_.enumeratePhysicalDevices();
-        auto pp = pdevs[0].getProperties();
-        physical_device_ = pdevs[0];
+        for (auto const &pdev : instance_.enumeratePhysicalDevices())
+        {
+            if (pdev.getProperties().apiVersion < VK_API_VERSION_1_2)
+            {
+                continue;
+            }
+            auto const features = pdev.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceTimelineSemaphoreFeatures>();
+            if (features.get<vk::PhysicalDeviceTimelineSemaphoreFeatures>().timelineSemaphore)
+            {
+                physical_device_ = pdev;
+                return;
+            }
+        }
+        throw std::runtime_error("no Vulkan 1.2 device with timeline semaphores!");
     }
 
     auto get_queue_families() -> void
     {
         auto dqfps = physical_device_.getQueueFamilyProperties();
 
+        //a transfer family without compute is the dedicated copy engine, any other one without graphics will do
         for (auto i = 0ul; i < dqfps.size(); ++i)
         {
             if (dqfps[i].queueFlags & vk::QueueFlagBits::eGraphics)
             {
                 graphics_queue_index_ = i;
             }
-            else if (dqfps[i].queueFlags & vk::QueueFlagBits::eTransfer)
+            else if ((dqfps[i].queueFlags & vk::QueueFlagBits::eTransfer)
+                     && (transfer_queue_index_ == UINT32_MAX || !(dqfps[i].queueFlags & vk::QueueFlagBits::eCompute)))
             {
                 transfer_queue_index_ = i;
             }
@@ -339,7 +361,10 @@ private:
         dqci[1].setQueuePriorities(qp);
 
         vk::DeviceCreateInfo dci;
+        vk::PhysicalDeviceTimelineSemaphoreFeatures ptsf;
+        ptsf.setTimelineSemaphore(VK_TRUE);
         vk::PhysicalDeviceDescriptorIndexingFeatures pddif;
+        pddif.setPNext(&ptsf);
         //pddif.setDescriptorBindingPartiallyBound(VK_TRUE);
         //pddif.setDescriptorBindingSampledImageUpdateAfterBind(VK_TRUE);
         //pddif.setDescriptorBindingVariableDescriptorCount(VK_TRUE);